@@ -0,0 +1,261 @@
+/***********************************************************
+ Aho-Corasick matching of all m/k query chunks in one pass.
+ The chunks are first put in a plain trie (first child / next
+ sibling lists), which is then laid out breadth first as a double
+ array: each state's children sit at base[s] + class, and check[]
+ tells which state a slot belongs to. Bytes are mapped to classes
+ (only the bytes the query uses get one), so a state's children
+ span at most nclasses slots.
+ Every chunk is k bytes long and no state is deeper than k, so a
+ chunk ends at position i of the document exactly when the state
+ after byte i is one of the k-deep (term) states.
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "acmatch.h"
+
+static void *
+ac_alloc(size_t sz)
+{
+  void *p = malloc(sz);
+  if (!p) {
+    fprintf(stderr, "ac_build: failed to allocate %lu bytes. No memory\n", (unsigned long) sz);
+    exit(1);
+  }
+  return p;
+}
+
+/* Make room for slots [0, need), marking the new ones free */
+static void
+ac_grow(ac_automaton *ac, int need)
+{
+  int size = ac->size, i;
+  if (need <= size) return;
+  while (size < need) size *= 2;
+  ac->base = (int *) realloc(ac->base, sizeof(int) * size);
+  ac->check = (int *) realloc(ac->check, sizeof(int) * size);
+  ac->fail = (int *) realloc(ac->fail, sizeof(int) * size);
+  ac->term = (int *) realloc(ac->term, sizeof(int) * size);
+  if (!ac->base || !ac->check || !ac->fail || !ac->term) {
+    fprintf(stderr, "ac_build: failed to grow to %d slots. No memory\n", size);
+    exit(1);
+  }
+  for (i = ac->size; i < size; i++) {
+    ac->base[i] = 0;
+    ac->check[i] = -1;
+    ac->fail[i] = 0;
+    ac->term[i] = -1;
+  }
+  ac->size = size;
+}
+
+/* The child of state s on class c, or -1 */
+static int
+ac_child(const ac_automaton *ac, int s, int c)
+{
+  int t = ac->base[s] + c;
+  return (ac->check[t] == s) ? t : -1;
+}
+
+/* A base >= 1 at which all n classes in cs (ascending) land on free
+   slots, searched from *from on. A single child fits any free slot, so
+   those start at the first free one and fill the holes; nodes with more
+   children search from where the last of them went (a rover only moving
+   forward), since rescanning the packed slots each time is quadratic. */
+static int
+ac_find_base(ac_automaton *ac, const int *cs, int n, int *from)
+{
+  int p, b, j;
+
+  for (p = *from; ; p++)
+  {
+    if (p < ac->size && ac->check[p] != -1) continue;
+    b = p - cs[0];
+    if (b < 1) continue;
+    ac_grow(ac, b + ac->nclasses + 1);
+    for (j = 1; j < n && ac->check[b + cs[j]] == -1; j++) ;
+    if (j == n) {
+      *from = p;
+      return b;
+    }
+  }
+}
+
+/* Build the automaton matching the m/k chunks qs[i*k .. i*k+k-1] */
+ac_automaton
+ac_build(const char *qs, long long m, int k)
+{
+  ac_automaton ac;
+  /* states are int: rkmatch keeps queries below 2 GB */
+  int nchunks = (k > 0) ? (int) (m / k) : 0;
+  int nodes = 1, maxnodes = nchunks * k + 1;
+  int *tchild, *tsib, *tcls, *tterm, *da, *queue;
+  int cs[257], kids[257];
+  int i, j, u, v, c, s, t, f, n, head, tail, lo = 1, rover = 1;
+
+  memset(ac.cls, 0, sizeof(ac.cls));
+  ac.nclasses = 0;
+  for (i = 0; i < nchunks * k; i++) {
+    if (!ac.cls[(unsigned char) qs[i]])
+      ac.cls[(unsigned char) qs[i]] = ++ac.nclasses;
+  }
+
+  /* the trie: node 0 is the root, children of a node are chained
+     through tsib in order of first insertion */
+  tchild = (int *) ac_alloc(sizeof(int) * maxnodes);
+  tsib = (int *) ac_alloc(sizeof(int) * maxnodes);
+  tcls = (int *) ac_alloc(sizeof(int) * maxnodes);
+  tterm = (int *) ac_alloc(sizeof(int) * maxnodes);
+  tchild[0] = -1;
+  tterm[0] = -1;
+  ac.chunk_term = (int *) ac_alloc(sizeof(int) * (nchunks > 0 ? nchunks : 1));
+  ac.nchunks = nchunks;
+  ac.nterms = 0;
+  for (i = 0; i < nchunks; i++)
+  {
+    u = 0;
+    for (j = 0; j < k; j++)
+    {
+      c = ac.cls[(unsigned char) qs[i*k + j]];
+      for (v = tchild[u]; v >= 0 && tcls[v] != c; v = tsib[v]) ;
+      if (v < 0) {
+        v = nodes++;
+        tchild[v] = -1;
+        tterm[v] = -1;
+        tcls[v] = c;
+        tsib[v] = tchild[u];
+        tchild[u] = v;
+      }
+      u = v;
+    }
+    if (tterm[u] < 0)
+      tterm[u] = ac.nterms++;
+    ac.chunk_term[i] = tterm[u];
+  }
+
+  /* lay the trie out breadth first. A state's fail link only depends on
+     shallower states, whose children are all placed by the time it is
+     dequeued. */
+  ac.size = 1;
+  ac.base = (int *) ac_alloc(sizeof(int));
+  ac.check = (int *) ac_alloc(sizeof(int));
+  ac.fail = (int *) ac_alloc(sizeof(int));
+  ac.term = (int *) ac_alloc(sizeof(int));
+  ac.base[0] = 0;
+  ac.check[0] = 0;
+  ac.fail[0] = 0;
+  ac.term[0] = -1;
+  ac_grow(&ac, 2 * nodes + ac.nclasses + 2);
+
+  da = (int *) ac_alloc(sizeof(int) * nodes);
+  queue = (int *) ac_alloc(sizeof(int) * nodes);
+  da[0] = 0;
+  head = tail = 0;
+  queue[tail++] = 0;
+  while (head < tail)
+  {
+    u = queue[head++];
+    s = da[u];
+    if (tchild[u] < 0) continue;
+
+    /* children by ascending class */
+    n = 0;
+    for (v = tchild[u]; v >= 0; v = tsib[v]) {
+      for (j = n; j > 0 && cs[j-1] > tcls[v]; j--) {
+        cs[j] = cs[j-1];
+        kids[j] = kids[j-1];
+      }
+      cs[j] = tcls[v];
+      kids[j] = v;
+      n++;
+    }
+    if (rover < lo) rover = lo;
+    ac.base[s] = ac_find_base(&ac, cs, n, (n == 1) ? &lo : &rover);
+    for (j = 0; j < n; j++) {
+      t = ac.base[s] + cs[j];
+      ac.check[t] = s;
+      ac.term[t] = tterm[kids[j]];
+      da[kids[j]] = t;
+      queue[tail++] = kids[j];
+    }
+    for (j = 0; j < n; j++) {
+      t = ac.base[s] + cs[j];
+      if (s == 0) {
+        ac.fail[t] = 0;
+        continue;
+      }
+      for (f = ac.fail[s]; f != 0 && ac_child(&ac, f, cs[j]) < 0; f = ac.fail[f]) ;
+      f = ac_child(&ac, f, cs[j]);
+      ac.fail[t] = (f >= 0) ? f : 0;
+    }
+  }
+
+  free(tchild);
+  free(tsib);
+  free(tcls);
+  free(tterm);
+  free(da);
+  free(queue);
+  return ac;
+}
+
+void
+ac_free(ac_automaton *ac)
+{
+  free(ac->base);
+  free(ac->check);
+  free(ac->fail);
+  free(ac->term);
+  free(ac->chunk_term);
+  ac->base = ac->check = ac->fail = ac->term = ac->chunk_term = NULL;
+}
+
+/* Run ts[0..n-1] through the automaton once.
+   Return how many of the m/k chunks (counting repeated chunks each
+   time, as SIMPLE and RK do) appear in ts. */
+int
+ac_match(const ac_automaton *ac, const char *ts, long long n)
+{
+  char *found;
+  long long i;
+  int c, s = 0, t, nfound = 0, num_matched = 0;
+
+  if (ac->nterms == 0) return 0;
+  found = (char *) calloc(ac->nterms, 1);
+  if (!found) {
+    fprintf(stderr, "ac_match: failed to allocate %d flags. No memory\n", ac->nterms);
+    exit(1);
+  }
+  for (i = 0; i < n; i++)
+  {
+    c = ac->cls[(unsigned char) ts[i]];
+    if (!c) {
+      /* no chunk contains this byte */
+      s = 0;
+      continue;
+    }
+    for (;;) {
+      t = ac->base[s] + c;
+      if (ac->check[t] == s) {
+        s = t;
+        break;
+      }
+      if (s == 0)
+        break;
+      s = ac->fail[s];
+    }
+    if (ac->term[s] >= 0 && !found[ac->term[s]]) {
+      found[ac->term[s]] = 1;
+      /* every chunk has been seen, the rest of ts cannot change the count */
+      if (++nfound == ac->nterms) break;
+    }
+  }
+  for (i = 0; i < ac->nchunks; i++) {
+    num_matched += found[ac->chunk_term[i]];
+  }
+  free(found);
+  return num_matched;
+}
@@ -0,0 +1,26 @@
+/***********************************************************
+ File Name: acmatch.h
+ Description: Aho-Corasick automaton over the m/k chunks of a
+              query, stored as a double array over byte classes
+ **********************************************************/
+
+/* State s has a child on byte class c at slot t = base[s] + c
+   iff check[t] == s. Every state's slots are in bounds for all classes.
+   State 0 is the root. */
+typedef struct {
+	int *base;        /* children of s start at base[s] */
+	int *check;       /* parent of the state at each slot, -1 if the slot is free */
+	int *fail;        /* state of the longest proper suffix that is also a state */
+	int *term;        /* distinct chunk ending at a k-deep state, -1 elsewhere */
+	int size;         /* number of slots */
+	int cls[256];     /* byte -> class 1..nclasses, 0 if no chunk has the byte */
+	int nclasses;
+	int *chunk_term;  /* distinct chunk (term) of each of the nchunks chunks */
+	int nchunks;
+	int nterms;       /* number of distinct chunks */
+} ac_automaton;
+
+ac_automaton ac_build(const char *qs, long long m, int k);
+void ac_free(ac_automaton *ac);
+
+int ac_match(const ac_automaton *ac, const char *ts, long long n);
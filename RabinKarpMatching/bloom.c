@@ -1,20 +1,47 @@
 /***********************************************************
  Implementation of bloom filter goes here 
+ Three layouts share the bloom_filter struct:
+   BLOOM_CLASSIC - each of an element's bits lands anywhere 
+                   in the bitmap
+   BLOOM_BLOCKED - a 64-bit mix of the element picks one 64-byte block
+                   and all of its bits land inside it, so an add or a
+                   query touches a single cache line
+   BLOOM_POW2    - 64-bit words, a power-of-two number of bits, and
+                   probe positions derived from one 64-bit mix of the
+                   element by masking: no % anywhere
+ BLOOM_CLASSIC is the compatibility layout whose bloom_print output 
+ the tests check.
+ bloom_init*() filters use BLOOM_HASH_NUM hashes; bloom_init_fpr*() 
+ picks the number of bits and hashes from an item count and a target
+ false positive rate instead.
+ Sizes and bit indices are 64-bit. hash_i() probe i only reaches bits
+ up to about H1PRIME + i*H2PRIME, so a classic filter of more than
+ H1PRIME bits probes with 64-bit positions from bloom_mix() instead,
+ mapped onto the bitmap by fast range; all three layouts spread over
+ any size.
  **********************************************************/
 
+#include <math.h>
+
 #include "bloom.h"
 
 /* Constants for bloom filter implementation */
 const int H1PRIME = 4189793;
 const int H2PRIME = 3296731;
 const int BLOOM_HASH_NUM = 10;
+#define BLOOM_HASH_MAX 32     /* most hashes bloom_init_fpr() will pick */
+#define BLOOM_BLOCK_BITS 512  /* one 64-byte cache line */
 
 /* The hash function used by the bloom filter */
-int
-hash_i(int i, /* which of the BLOOM_HASH_NUM hashes to use */ 
+long long
+hash_i(int i, /* which of the filter's nhash hashes to use */ 
        long long x /* a long long value to be hashed */)
 {
-	return ((x % H1PRIME) + i*(x % H2PRIME) + 1 + i*i);
+	/* unsigned, so hash engines whose values use all 64 bits still index 
+	   inside the bitmap (identical for the non-negative values of the 
+	   prime engine) */
+	unsigned long long ux = (unsigned long long) x;
+	return ((ux % H1PRIME) + i*(ux % H2PRIME) + 1 + i*i);
 }
 
 /* Initialize a bloom filter by allocating a character array that can pack bsz bits.
@@ -23,33 +50,313 @@ hash_i(int i, /* which of the BLOOM_HASH_NUM hashes to use */
    Hint:  use the malloc and bzero library function 
 	 Return value is the newly initialized bloom_filter struct.*/
 bloom_filter 
-bloom_init(int bsz /* size of bitmap to allocate in bits*/ )
+bloom_init(long long bsz /* size of bitmap to allocate in bits*/ )
+{
+  return bloom_init_kind(bsz, BLOOM_CLASSIC);
+}
+
+/* Blocked layout: round bsz up to whole cache-line-aligned blocks */
+static bloom_filter
+bloom_init_blocked(long long bsz)
+{
+  bloom_filter f;
+  long long nblocks = (bsz + BLOOM_BLOCK_BITS - 1) / BLOOM_BLOCK_BITS;
+  void *buf;
+
+  if (nblocks < 1) nblocks = 1;
+  f.kind = BLOOM_BLOCKED;
+  f.nhash = BLOOM_HASH_NUM;
+  f.bsz = nblocks * BLOOM_BLOCK_BITS;
+  if (posix_memalign(&buf, 64, f.bsz >> 3) != 0) {
+    fprintf(stderr, "bloom_init: failed to allocate %lld bits. No memory\n", f.bsz);
+    exit(1);
+  }
+  f.buf = (char *) buf;
+  memset(f.buf, 0, f.bsz >> 3);
+  return f;
+}
+
+/* Power-of-two layout: round bsz up to a power of two (at least one word) */
+static bloom_filter
+bloom_init_pow2(long long bsz)
+{
+  bloom_filter f;
+  long long bits = 64;
+
+  while (bits < bsz) bits <<= 1;
+  f.kind = BLOOM_POW2;
+  f.nhash = BLOOM_HASH_NUM;
+  f.bsz = bits;
+  f.buf = (char *) calloc(bits >> 6, sizeof(unsigned long long));
+  if (!f.buf) {
+    fprintf(stderr, "bloom_init: failed to allocate %lld bits. No memory\n", bits);
+    exit(1);
+  }
+  return f;
+}
+
+/* Initialize a bloom filter of bsz bits with the given layout */
+bloom_filter
+bloom_init_kind(long long bsz, /* size of bitmap to allocate in bits*/
+                int kind /* one of enum bloom_kind */)
 {
   bloom_filter f;
+  if (kind == BLOOM_BLOCKED)
+    return bloom_init_blocked(bsz);
+  if (kind == BLOOM_POW2)
+    return bloom_init_pow2(bsz);
+  f.kind = BLOOM_CLASSIC;
+  f.nhash = BLOOM_HASH_NUM;
   f.bsz = bsz;
-  int i;
   /*Change bitsize to the correct number of Char* needed(Char * is 8 bits)*/
   if (bsz % 8) bsz = (bsz >> 3) + 1;
   else bsz = (bsz >> 3);
-  /*Allocate the appropriate amount of memory for based on bit size*/
-  f.buf = (char *) malloc(bsz);
-  /* Set all the Char* to NULL (00000000 in Binary)*/
-  for(i = 0; i < bsz; i++)
-  {
-    f.buf[i] =  NULL;
+  /*Allocate the appropriate amount of memory for based on bit size,
+    with every bit cleared*/
+  f.buf = (char *) calloc(bsz, 1);
+  if (!f.buf) {
+    fprintf(stderr, "bloom_init: failed to allocate %lld bits. No memory\n", f.bsz);
+    exit(1);
+  }
+  return f;
+}
+
+/* Initialize a classic bloom filter sized to hold n_items elements with
+   a false positive rate of about target_fpr */
+bloom_filter
+bloom_init_fpr(long long n_items, double target_fpr)
+{
+  return bloom_init_fpr_kind(n_items, target_fpr, BLOOM_CLASSIC);
+}
+
+/* Size a filter for n_items elements and a false positive rate of 
+   target_fpr: bits = -n ln(p) / ln(2)^2, hashes = bits/n * ln(2).
+   The layout may round the bits up further (pow2), and a blocked filter
+   ends up somewhat above target_fpr; bloom_expected_fpr() tells. */
+bloom_filter
+bloom_init_fpr_kind(long long n_items, double target_fpr, int kind)
+{
+  bloom_filter f;
+  double bits;
+  int nhash;
+
+  if (!(target_fpr > 0 && target_fpr < 1)) {
+    fprintf(stderr, "bloom_init_fpr: false positive rate %g is not in (0, 1)\n", target_fpr);
+    exit(1);
+  }
+  if (n_items < 1) n_items = 1;
+  bits = ceil(-n_items * log(target_fpr) / (M_LN2 * M_LN2));
+  if (bits < 64) bits = 64;
+  if (bits > 9e18) {
+    fprintf(stderr, "bloom_init_fpr: %lld items at rate %g need %.0f bits, too many\n", 
+            n_items, target_fpr, bits);
+    exit(1);
   }
+  nhash = (int) (bits / n_items * M_LN2 + 0.5);
+  if (nhash < 1) nhash = 1;
+  if (nhash > BLOOM_HASH_MAX) nhash = BLOOM_HASH_MAX;
+
+  f = bloom_init_kind(((long long) bits + 7) & ~7LL, kind);
+  f.nhash = nhash;
   return f;
 }
 
+/* The false positive rate f should show once n_items elements are in it.
+   For the classic and pow2 layouts it is (1 - e^(-kn/m))^k, m being
+   every bit of the bitmap since both probe all of it (a classic filter
+   past hash_i()'s reach through bloom_add_wide()). A blocked 
+   filter is a set of small filters whose loads vary: average the 
+   in-block rate over the Poisson distribution of elements per block.
+   In a 512-bit block the number of bits set by j elements varies too
+   much to use its mean, so occ[b] tracks the probability that b bits
+   are set as the block's k*j probes land, and the in-block rate is the
+   average of (b/512)^k over it. */
+double
+bloom_expected_fpr(bloom_filter f, long long n_items)
+{
+  double k = f.nhash, lambda, pj, fpr, fj;
+  double occ[BLOOM_BLOCK_BITS + 1], hitk[BLOOM_BLOCK_BITS + 1];
+  int j, jmax, b, t;
+
+  if (f.kind != BLOOM_BLOCKED)
+    return pow(1 - exp(-k * n_items / (double) f.bsz), k);
+
+  for (b = 0; b <= BLOOM_BLOCK_BITS; b++) {
+    occ[b] = (b == 0);
+    hitk[b] = pow((double) b / BLOOM_BLOCK_BITS, k);
+  }
+  lambda = (double) n_items * BLOOM_BLOCK_BITS / f.bsz;
+  jmax = (int) (lambda + 10 * sqrt(lambda)) + 20;
+  pj = exp(-lambda);
+  fpr = 0;
+  for (j = 0; j <= jmax; j++) {
+    for (b = 0, fj = 0; b <= BLOOM_BLOCK_BITS; b++)
+      fj += occ[b] * hitk[b];
+    fpr += pj * fj;
+    pj *= lambda / (j + 1);
+    /* the next element's probes: each sets a new bit with 
+       probability (512 - b)/512 */
+    for (t = 0; t < f.nhash; t++) {
+      for (b = BLOOM_BLOCK_BITS - 1; b >= 0; b--)
+        occ[b+1] = occ[b+1] * (b + 1) / BLOOM_BLOCK_BITS 
+          + occ[b] * (BLOOM_BLOCK_BITS - b) / BLOOM_BLOCK_BITS;
+      occ[0] = 0;
+    }
+  }
+  return fpr;
+}
+
+/* One 64-bit mix (the splitmix64 finalizer) of elm. Probe i of a 
+   power-of-two filter is (h + i*step) & mask, with step = the rotated
+   mix forced odd so the probes stay distinct */
+static unsigned long long
+bloom_mix(long long elm)
+{
+  unsigned long long z = (unsigned long long) elm;
+  z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+  return z ^ (z >> 31);
+}
+
+/* The block of a blocked filter that holds all of elm's bits: the mix
+   of elm mapped onto the blocks by multiplying (fast range, 128-bit
+   product), so that any number of blocks is reached */
+static unsigned long long *
+bloom_block(bloom_filter f, long long elm)
+{
+  unsigned long long nblocks = f.bsz / BLOOM_BLOCK_BITS;
+  unsigned long long b = (unsigned long long) 
+    (((unsigned __int128) bloom_mix(elm) * nblocks) >> 64);
+  return (unsigned long long *) f.buf + (BLOOM_BLOCK_BITS / 64) * b;
+}
+
+/* The in-block bits of elm are 9-bit slices of a mix of elm seeded apart
+   from the block's, 7 to a 64-bit word and remixed for the next 7, so
+   they are uniform and independent of each other as bloom_expected_fpr()
+   assumes. */
+#define BLOOM_BIT_SEED 0x9E3779B97F4A7C15ULL
+#define BLOOM_SLICES 7  /* 9-bit slices per mix */
+
+static void
+bloom_add_blocked(bloom_filter f, long long elm)
+{
+  unsigned long long *block = bloom_block(f, elm);
+  unsigned long long g = bloom_mix((long long) ((unsigned long long) elm ^ BLOOM_BIT_SEED)), bits = g;
+  int i, bit;
+  for (i = 0; i < f.nhash; i++, bits >>= 9)
+  {
+    if (i > 0 && i % BLOOM_SLICES == 0)
+      bits = g = bloom_mix((long long) g);
+    bit = (int) (bits & (BLOOM_BLOCK_BITS - 1));
+    block[bit >> 6] |= 1ULL << (bit & 63);
+  }
+}
+
+static int
+bloom_query_blocked(bloom_filter f, long long elm)
+{
+  unsigned long long *block = bloom_block(f, elm);
+  unsigned long long g = bloom_mix((long long) ((unsigned long long) elm ^ BLOOM_BIT_SEED)), bits = g;
+  int i, bit;
+  for (i = 0; i < f.nhash; i++, bits >>= 9)
+  {
+    if (i > 0 && i % BLOOM_SLICES == 0)
+      bits = g = bloom_mix((long long) g);
+    bit = (int) (bits & (BLOOM_BLOCK_BITS - 1));
+    if (!(block[bit >> 6] & (1ULL << (bit & 63))))
+      return 0;
+  }
+  return 1;
+}
+
+static void
+bloom_add_pow2(bloom_filter f, long long elm)
+{
+  unsigned long long *words = (unsigned long long *) f.buf;
+  unsigned long long mask = (unsigned long long) f.bsz - 1;
+  unsigned long long h = bloom_mix(elm), step = ((h >> 32) | (h << 32)) | 1, bit;
+  int i;
+  for (i = 0; i < f.nhash; i++, h += step)
+  {
+    bit = h & mask;
+    words[bit >> 6] |= 1ULL << (bit & 63);
+  }
+}
+
+static int
+bloom_query_pow2(bloom_filter f, long long elm)
+{
+  const unsigned long long *words = (const unsigned long long *) f.buf;
+  unsigned long long mask = (unsigned long long) f.bsz - 1;
+  unsigned long long h = bloom_mix(elm), step = ((h >> 32) | (h << 32)) | 1, bit;
+  int i;
+  for (i = 0; i < f.nhash; i++, h += step)
+  {
+    bit = h & mask;
+    if (!(words[bit >> 6] & (1ULL << (bit & 63))))
+      return 0;
+  }
+  return 1;
+}
+
+/* Classic filters past hash_i()'s reach: probe i is the top bits of 
+   (h + i*step) * bsz, with h and step from one mix as for pow2, so every
+   bit of the bitmap is probed evenly. Bits keep the classic order. */
+#define BLOOM_CLASSIC_WIDE(f) ((f).bsz > H1PRIME)
+
+static unsigned long long
+bloom_range(unsigned long long h, long long bsz)
+{
+  return (unsigned long long) (((unsigned __int128) h * (unsigned long long) bsz) >> 64);
+}
+
+static void
+bloom_add_wide(bloom_filter f, long long elm)
+{
+  unsigned long long h = bloom_mix(elm), step = ((h >> 32) | (h << 32)) | 1, bit;
+  int i;
+  for (i = 0; i < f.nhash; i++, h += step)
+  {
+    bit = bloom_range(h, f.bsz);
+    f.buf[bit >> 3] |= 1 << (7 - bit % 8);
+  }
+}
+
+static int
+bloom_query_wide(bloom_filter f, long long elm)
+{
+  unsigned long long h = bloom_mix(elm), step = ((h >> 32) | (h << 32)) | 1, bit;
+  int i;
+  for (i = 0; i < f.nhash; i++, h += step)
+  {
+    bit = bloom_range(h, f.bsz);
+    if (!(f.buf[bit >> 3] & (1 << (7 - bit % 8))))
+      return 0;
+  }
+  return 1;
+}
+
 /* Add elm into the given bloom filter*/
 void
 bloom_add(bloom_filter f,
           long long elm /* the element to be added (a RK hash value) */)
 {
   int i; 
-  int bit;
+  long long bit;
+  if (f.kind == BLOOM_BLOCKED) {
+    bloom_add_blocked(f, elm);
+    return;
+  }
+  if (f.kind == BLOOM_POW2) {
+    bloom_add_pow2(f, elm);
+    return;
+  }
+  if (BLOOM_CLASSIC_WIDE(f)) {
+    bloom_add_wide(f, elm);
+    return;
+  }
   /* Loop over each hash function*/
-  for (i = 0; i < BLOOM_HASH_NUM; i++)
+  for (i = 0; i < f.nhash; i++)
   {
     bit = hash_i(i, elm) % f.bsz;
     /* In the correct Char * for the bit
@@ -65,9 +372,15 @@ bloom_query(bloom_filter f,
             long long elm /* the query element */ )
 {	
   int i; 
-  int bit;
+  long long bit;
+  if (f.kind == BLOOM_BLOCKED)
+    return bloom_query_blocked(f, elm);
+  if (f.kind == BLOOM_POW2)
+    return bloom_query_pow2(f, elm);
+  if (BLOOM_CLASSIC_WIDE(f))
+    return bloom_query_wide(f, elm);
   /* Loop over each hash function*/
-  for (i = 0; i < BLOOM_HASH_NUM; i++)
+  for (i = 0; i < f.nhash; i++)
   {
     bit = hash_i(i, elm) % f.bsz;
     /* If there is a zero in any bit slot which the query hash has a 1,
@@ -81,24 +394,65 @@ bloom_query(bloom_filter f,
   return 1;
 }
 
+/* Query n elements at once: out[j] = bloom_query(f, hashes[j]).
+   The line holding the first probe of every element in a group of
+   BLOOM_BATCH is prefetched before any of them is tested, so the cache
+   misses of the whole group overlap instead of being paid one after
+   another. Most elements are rejected by their first probe or two, so 
+   the remaining probes are left to the usual early-exit query. */
+void
+bloom_query_batch(bloom_filter f, const long long *hashes, int n, uint8_t *out)
+{
+  unsigned long long mask = (unsigned long long) f.bsz - 1;
+  int j, nb;
+
+  for (; n > 0; n -= nb, hashes += nb, out += nb)
+  {
+    nb = (n < BLOOM_BATCH) ? n : BLOOM_BATCH;
+    for (j = 0; j < nb; j++) {
+      if (f.kind == BLOOM_BLOCKED)
+        __builtin_prefetch(bloom_block(f, hashes[j]));
+      else if (f.kind == BLOOM_POW2)
+        __builtin_prefetch(&f.buf[(bloom_mix(hashes[j]) & mask) >> 3]);
+      else if (BLOOM_CLASSIC_WIDE(f))
+        __builtin_prefetch(&f.buf[bloom_range(bloom_mix(hashes[j]), f.bsz) >> 3]);
+      else
+        __builtin_prefetch(&f.buf[(hash_i(0, hashes[j]) % f.bsz) >> 3]);
+    }
+    for (j = 0; j < nb; j++)
+      out[j] = bloom_query(f, hashes[j]);
+  }
+}
+
 void 
 bloom_free(bloom_filter *f)
 {
 	free(f->buf);
-	f->buf = f->bsz = 0;
+	f->buf = NULL;
+	f->bsz = 0;
 }
 
-/* print out the first count bits in the bloom filter */
+/* print out the first count bits in the bloom filter 
+   (in the classic layout's order, bit 0 being the top bit of the first byte) */
 void
 bloom_print(bloom_filter f,
             int count     /* number of bits to display*/ )
 {
-	int i;
+	const unsigned long long *words = (const unsigned long long *) f.buf;
+	long long i;
+	int b, byte;
 
 	assert(count % 8 == 0);
 
 	for(i=0; i< (f.bsz>>3) && i < (count>>3); i++) {
-		printf("%02x ", (unsigned char)(f.buf[i]));
+		if (f.kind == BLOOM_CLASSIC) {
+			byte = (unsigned char)(f.buf[i]);
+		} else {
+			/* word layouts keep bit b at bit b%64 of word b/64 */
+			for (b = 0, byte = 0; b < 8; b++)
+				byte = (byte << 1) | (int)((words[(8*i + b) >> 6] >> ((8*i + b) & 63)) & 1);
+		}
+		printf("%02x ", byte);
 	}
 	printf("\n");
 	return;
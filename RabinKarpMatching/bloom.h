@@ -6,16 +6,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <stdint.h>
+
+/* bit layouts selectable at bloom_init_kind() time */
+enum bloom_kind { BLOOM_CLASSIC = 0, BLOOM_BLOCKED, BLOOM_POW2 };
 
 typedef struct {
   char *buf; /* the bitmap representing the bloom filter*/
-  int bsz; /* size of bitmap in bits*/
+  long long bsz; /* size of bitmap in bits*/
+  int kind; /* one of enum bloom_kind */
+  int nhash; /* number of bits set per element */
 } bloom_filter;
 
-bloom_filter bloom_init(int bsz);
+bloom_filter bloom_init(long long bsz);
+bloom_filter bloom_init_kind(long long bsz, int kind);
+bloom_filter bloom_init_fpr(long long n_items, double target_fpr);
+bloom_filter bloom_init_fpr_kind(long long n_items, double target_fpr, int kind);
+double bloom_expected_fpr(bloom_filter f, long long n_items);
 void bloom_free(bloom_filter *f);
 
 void bloom_add(bloom_filter f, long long elm);
 int bloom_query(bloom_filter f, long long elm);
 
+/* largest batch bloom_query_batch() prefetches at once */
+#define BLOOM_BATCH 32
+void bloom_query_batch(bloom_filter f, const long long *hashes, int n, uint8_t *out);
+
 void bloom_print(bloom_filter f, int count);
@@ -9,9 +9,173 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
+#include <math.h>
 
 #include "bloom.h"
 
+const char *KIND_NAMES[] = { "classic", "blocked", "pow2" };
+#define NUM_KINDS 3
+
+double
+now_sec(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+long long
+random_ll(void)
+{
+	long long rll = (long long) random();
+	return rll << 31 | random();
+}
+
+/* Compare the false positive rate and the query throughput of every
+	 bloom filter layout, each holding bsz/10 random elements */
+void
+bench(int bsz)
+{
+	int n_inserted = bsz/10, n_queries = 10000000;
+	long long *inserted = (long long *)malloc(sizeof(long long)*n_inserted);
+	long long *queries = (long long *)malloc(sizeof(long long)*n_queries);
+	bloom_filter bf;
+	int kind, i, matched;
+	volatile int sink = 0;
+	double t;
+
+	/* one random stream, so the queries are (almost surely) never inserted */
+	for (i = 0; i < n_inserted; i++) {
+		inserted[i] = random_ll();
+	}
+	for (i = 0; i < n_queries; i++) {
+		queries[i] = random_ll();
+	}
+	printf("%-8s %12s %12s %12s %14s\n", "layout", "bits", "fpr", "expected", "Mqueries/s");
+	for (kind = 0; kind < NUM_KINDS; kind++) {
+		bf = bloom_init_kind(bsz, kind);
+		for (i = 0; i < n_inserted; i++) {
+			bloom_add(bf, inserted[i]);
+		}
+		matched = 0;
+		t = now_sec();
+		for (i = 0; i < n_queries; i++) {
+			matched += bloom_query(bf, queries[i]);
+		}
+		t = now_sec() - t;
+		sink += matched;
+		printf("%-8s %12lld %12.6f %12.6f %14.2f\n", KIND_NAMES[kind], bf.bsz,
+				(double)matched/n_queries, bloom_expected_fpr(bf, n_inserted), n_queries/t/1e6);
+		bloom_free(&bf);
+	}
+	free(inserted);
+	free(queries);
+}
+
+/* Set bits among bytes [from, to) of the bitmap */
+long long
+count_set(bloom_filter bf, long long from, long long to)
+{
+	long long i, n = 0;
+	for (i = from; i < to; i++)
+		n += __builtin_popcount((unsigned char) bf.buf[i]);
+	return n;
+}
+
+/* Whether a rate measured over n queries is off the expected one by more
+	 than 20% and four standard deviations of the count */
+int
+far_from(double fpr, double expected, int n)
+{
+	return fabs(fpr - expected) > 0.2 * expected + 4 * sqrt(expected / n);
+}
+
+/* Size filters of every layout with bloom_init_fpr_kind() for n_items 
+	 elements and a 1% false positive rate, and check the rate they show
+	 against bloom_expected_fpr() and the target. Return 0 if all pass. */
+int
+fpr_sized(int n_items)
+{
+	int n_queries = 1000000;
+	bloom_filter bf;
+	int kind, i, matched, failed = 0;
+	double fpr, expected;
+
+	for (kind = 0; kind < NUM_KINDS; kind++) {
+		bf = bloom_init_fpr_kind(n_items, 0.01, kind);
+		for (i = 0; i < n_items; i++) {
+			bloom_add(bf, random_ll());
+		}
+		matched = 0;
+		for (i = 0; i < n_queries; i++) {
+			matched += bloom_query(bf, random_ll());
+		}
+		fpr = (double) matched/n_queries;
+		expected = bloom_expected_fpr(bf, n_items);
+		printf("%-8s %12lld bits, %2d hashes for %d items at 1%%: fpr %.6f (expected %.6f)\n",
+				KIND_NAMES[kind], bf.bsz, bf.nhash, n_items, fpr, expected);
+		/* pow2 rounds the bits up, blocked ends up somewhat above the target */
+		if (far_from(fpr, expected, n_queries) || fpr > 0.015) {
+			printf("%s: the filter misses its false positive rate\n", KIND_NAMES[kind]);
+			failed = 1;
+		}
+		bloom_free(&bf);
+	}
+	return failed;
+}
+
+/* Check every layout at a size past the range of hash_i() (about 34M bits
+	 for 10 hashes): no inserted element missing, the last quarter of the
+	 bitmap about as full as the whole, and the false positive rate close
+	 to bloom_expected_fpr(). Return 0 if all of them pass. */
+int
+wide(int bsz)
+{
+	int n_inserted = bsz/10, n_queries = 1000000;
+	bloom_filter bf;
+	int kind, i, matched, failed = 0;
+	long long *inserted = (long long *)malloc(sizeof(long long)*n_inserted);
+	long long bytes;
+	double fpr, expected, fill, fill_end;
+
+	for (i = 0; i < n_inserted; i++) {
+		inserted[i] = random_ll();
+	}
+	for (kind = 0; kind < NUM_KINDS; kind++) {
+		bf = bloom_init_kind(bsz, kind);
+		for (i = 0; i < n_inserted; i++) {
+			bloom_add(bf, inserted[i]);
+		}
+		for (i = 0; i < n_inserted; i++) {
+			if (!bloom_query(bf, inserted[i])) {
+				printf("%s: %lld inserted, but not present according to bloom_query\n", 
+						KIND_NAMES[kind], inserted[i]);
+				failed = 1;
+				break;
+			}
+		}
+		matched = 0;
+		for (i = 0; i < n_queries; i++) {
+			matched += bloom_query(bf, random_ll());
+		}
+		bytes = bf.bsz >> 3;
+		fill = (double) count_set(bf, 0, bytes) / bf.bsz;
+		fill_end = (double) count_set(bf, bytes - bytes/4, bytes) / (8 * (bytes/4));
+		fpr = (double) matched/n_queries;
+		expected = bloom_expected_fpr(bf, n_inserted);
+		printf("%-8s %12lld bits, fill %.4f (last quarter %.4f), fpr %.6f (expected %.6f)\n",
+				KIND_NAMES[kind], bf.bsz, fill, fill_end, fpr, expected);
+		if (fill_end < 0.9 * fill || far_from(fpr, expected, n_queries)) {
+			printf("%s: the bitmap is not used evenly\n", KIND_NAMES[kind]);
+			failed = 1;
+		}
+		bloom_free(&bf);
+	}
+	free(inserted);
+	return failed;
+}
+
 int
 main(int argc, char **argv)
 {
@@ -24,7 +188,9 @@ main(int argc, char **argv)
 	int i;
 
   if(argc < 2) {
-    printf("Usage:\n ./bloom_test <bitmap_size> <random_num_seed>\n");
+    printf("Usage:\n ./bloom_test <bitmap_size> <random_num_seed>\n"
+           " ./bloom_test <bitmap_size> <random_num_seed> bench\n"
+           " ./bloom_test <bitmap_size> <random_num_seed> wide\n");
     exit(1);
   }
 
@@ -32,6 +198,14 @@ main(int argc, char **argv)
 	if (argc > 2) {
 		srandom(atoi(argv[2]));
 	}
+	if (argc > 3 && strcmp(argv[3], "bench") == 0) {
+		bench(bsz);
+		return 0;
+	}
+	if (argc > 3 && strcmp(argv[3], "wide") == 0) {
+		/* and filters sized by rate for as many items */
+		return wide(bsz) | fpr_sized(bsz/10);
+	}
 
 	n_inserted = bsz/10;
 	testnums = (long long *)malloc(sizeof(long long)*n_inserted);
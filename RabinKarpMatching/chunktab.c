@@ -0,0 +1,86 @@
+/***********************************************************
+ Chunk table: maps the RK hash of each m/k query chunk to the
+ chunk numbers with that hash, so a bloom filter hit is verified
+ against the few chunks whose hash collides instead of all of them.
+ Slots are probed linearly; chunks sharing a hash are chained
+ through next[], indexed by chunk number.
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "chunktab.h"
+
+/* spread the hash bits before masking, RK hashes of similar
+   chunks differ mostly in their low bits */
+static int
+chunktab_slot(const chunk_table *t, long long key)
+{
+  unsigned long long x = (unsigned long long) key * 0x9E3779B97F4A7C15ULL;
+  return (int) (x >> 32) & t->mask;
+}
+
+/* Allocate an empty table with room for nchunks chunks,
+   kept at most half full */
+chunk_table
+chunktab_init(int nchunks)
+{
+  chunk_table t;
+  int slots = 16, i;
+
+  while (slots < 2 * nchunks) slots <<= 1;
+  t.mask = slots - 1;
+  t.keys = (long long *) malloc(sizeof(long long) * slots);
+  t.heads = (int *) malloc(sizeof(int) * slots);
+  t.next = (int *) malloc(sizeof(int) * (nchunks > 0 ? nchunks : 1));
+  if (!t.keys || !t.heads || !t.next) {
+    fprintf(stderr, "chunktab_init: failed to allocate %d slots. No memory\n", slots);
+    exit(1);
+  }
+  for (i = 0; i < slots; i++) {
+    t.heads[i] = -1;
+  }
+  return t;
+}
+
+void
+chunktab_free(chunk_table *t)
+{
+  free(t->keys);
+  free(t->heads);
+  free(t->next);
+  t->keys = NULL;
+  t->heads = t->next = NULL;
+}
+
+/* Record that chunk number 'chunk' hashes to key */
+void
+chunktab_add(chunk_table *t, long long key, int chunk)
+{
+  int s = chunktab_slot(t, key);
+  while (t->heads[s] >= 0 && t->keys[s] != key) {
+    s = (s + 1) & t->mask;
+  }
+  t->keys[s] = key;
+  t->next[chunk] = t->heads[s];
+  t->heads[s] = chunk;
+}
+
+/* Return the first chunk hashing to key, or -1 if there is none */
+int
+chunktab_first(const chunk_table *t, long long key)
+{
+  int s = chunktab_slot(t, key);
+  while (t->heads[s] >= 0) {
+    if (t->keys[s] == key) return t->heads[s];
+    s = (s + 1) & t->mask;
+  }
+  return -1;
+}
+
+/* Return the next chunk with the same hash as 'chunk', or -1 */
+int
+chunktab_next(const chunk_table *t, int chunk)
+{
+  return t->next[chunk];
+}
@@ -0,0 +1,19 @@
+/***********************************************************
+ File Name: chunktab.h
+ Description: open-addressed table from a query chunk's RK hash
+              to the chunks that have that hash
+ **********************************************************/
+
+typedef struct {
+	long long *keys;  /* the RK hash every chunk listed in a slot shares */
+	int *heads;       /* first chunk in the slot, -1 if the slot is empty */
+	int *next;        /* next chunk with the same hash, -1 ends the list */
+	int mask;         /* number of slots - 1, slots are a power of two */
+} chunk_table;
+
+chunk_table chunktab_init(int nchunks);
+void chunktab_free(chunk_table *t);
+
+void chunktab_add(chunk_table *t, long long key, int chunk);
+int chunktab_first(const chunk_table *t, long long key);
+int chunktab_next(const chunk_table *t, int chunk);
@@ -0,0 +1,146 @@
+/***********************************************************
+ Reading documents into memory, normalized, for rkmatch and rkindex.
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#include "normalize.h"
+#include "docload.h"
+
+/* how documents are brought into memory (rkmatch -l) */
+int LOADER = LOAD_MMAP;
+
+int NORMALIZE_THREADS = 1;
+
+/* below this, a document is normalized by one thread whatever NORMALIZE_THREADS */
+#define NORMALIZE_PARALLEL_MIN (4 << 20)
+
+/* normalize_to(), with NORMALIZE_THREADS threads if len is worth it */
+static long long
+normalize_doc(char *dst, const char *src, long long len)
+{
+	if (NORMALIZE_THREADS > 1 && len >= NORMALIZE_PARALLEL_MIN)
+		return normalize_parallel(dst, src, len, NORMALIZE_THREADS);
+	return normalize_to(dst, src, len);
+}
+
+/* read the entire content of the file 'fname' into a 
+	 character array allocated by this procedure.
+	 Upon return, *doc contains the address of the character array
+	 *doc_len contains the length of the array
+	 */
+void
+read_file(const char *fname, char **doc, long long *doc_len) 
+{
+	struct stat st;
+	int fd;
+	long long n = 0;
+	ssize_t got = 0;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		perror("read_file: open ");
+		exit(1);
+	}
+
+	if (fstat(fd, &st) != 0) {
+		perror("read_file: fstat ");
+		exit(1);
+	}
+
+	/* one spare byte for normalize's terminator */
+	*doc = (char *)malloc(st.st_size + 1);
+	if (!(*doc)) {
+		fprintf(stderr, " failed to allocate %lld bytes. No memory\n", (long long)st.st_size);
+		exit(1);
+	}
+
+	/* a single read() returns at most about 2 GB */
+	while (n < st.st_size && (got = read(fd, *doc + n, st.st_size - n)) > 0)
+		n += got;
+	if (got < 0) {
+		perror("read_file: read ");
+		exit(1);
+	}else if (n != st.st_size) {
+		fprintf(stderr,"read_file: short read!\n");
+		exit(1);
+	}
+	
+	close(fd);
+	*doc_len = n;
+}
+
+
+/* Map the file 'fname' read-only and normalize it straight out of the 
+	 page cache into a character array allocated by this procedure, 
+	 instead of read()ing a private copy first and normalizing that.
+	 MADV_SEQUENTIAL lets the kernel read ahead and drop pages behind
+	 the normalize pass, so a cold file is never fully resident twice.
+	 The normalized copy is still the whole document, made before its
+	 first window can be hashed; only rkmatch -l fused (RKBATCH) avoids
+	 that, by normalizing and hashing a block at a time from the mapping
+	 (rabin_karp_fusedmatch).
+	 Upon return, *doc and *doc_len are as for read_file + normalize.
+	 */
+void
+map_file(const char *fname, char **doc, long long *doc_len)
+{
+	struct stat st;
+	int fd;
+	char *map;
+
+	fd = open(fname, O_RDONLY);
+	if (fd < 0) {
+		perror("map_file: open ");
+		exit(1);
+	}
+
+	if (fstat(fd, &st) != 0) {
+		perror("map_file: fstat ");
+		exit(1);
+	}
+
+	*doc = (char *)malloc(st.st_size + 1);
+	if (!(*doc)) {
+		fprintf(stderr, " failed to allocate %lld bytes. No memory\n", (long long)st.st_size);
+		exit(1);
+	}
+
+	/* mmap refuses empty mappings */
+	if (st.st_size == 0) {
+		close(fd);
+		(*doc)[0] = 0;
+		*doc_len = 0;
+		return;
+	}
+
+	map = (char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (map == MAP_FAILED) {
+		perror("map_file: mmap ");
+		exit(1);
+	}
+	close(fd);
+	/* only advisory, ignore failures */
+	madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+	*doc_len = normalize_doc(*doc, map, (long long)st.st_size);
+	munmap(map, st.st_size);
+}
+
+/* Read and normalize 'fname' with the selected loader */
+void
+load_file(const char *fname, char **doc, long long *doc_len)
+{
+	if (LOADER == LOAD_READ) {
+		read_file(fname, doc, doc_len);
+		*doc_len = normalize_doc(*doc, *doc, *doc_len);
+	} else {
+		map_file(fname, doc, doc_len);
+	}
+}
@@ -0,0 +1,17 @@
+/***********************************************************
+ File Name: docload.h
+ Description: loading and normalizing documents
+ **********************************************************/
+
+/* how documents are brought into memory. LOAD_FUSED maps them like
+   LOAD_MMAP; RKBATCH then normalizes and hashes its documents in one
+   pass without a normalized copy (see rabin_karp_fusedmatch) */
+enum loadtype { LOAD_READ = 0, LOAD_MMAP, LOAD_FUSED };
+extern int LOADER;
+
+/* threads that normalize one document (rkmatch -j with one document) */
+extern int NORMALIZE_THREADS;
+
+void read_file(const char *fname, char **doc, long long *doc_len);
+void map_file(const char *fname, char **doc, long long *doc_len);
+void load_file(const char *fname, char **doc, long long *doc_len);
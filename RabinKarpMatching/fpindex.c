@@ -0,0 +1,230 @@
+/***********************************************************
+ k-gram fingerprint index of a corpus.
+ One record per window of every document (or per winnowed fingerprint,
+ see winnow.c), sorted by hash, so all the windows with a given RK
+ hash are adjacent. The file is
+   fp_header | fp_record[nrecs] | ndocs NUL-terminated names
+ and is used straight from an mmap() of it. Hashes of the m61,
+ wrap64 and buz engines (and of prime, within its modulus) are
+ close to uniform, so lookups interpolate between the hashes at
+ the ends of the range instead of only halving it.
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "fpindex.h"
+
+#define FP_MAGIC "RKFP"
+#define FP_VERSION 3
+
+typedef struct {
+	char magic[4];
+	int version;
+	int k;
+	int ndocs;
+	int winnow;              /* window the records were winnowed with, 1 for all */
+	int pad;
+	char engine[16];
+	long long modulus;
+	long long nrecs;
+	long long names_off;     /* byte offset of the name table */
+} fp_header;
+
+/* order records by hash (as unsigned, the order interpolation needs),
+   then by document and offset */
+static int
+fp_record_cmp(const void *a, const void *b)
+{
+  const fp_record *x = (const fp_record *) a, *y = (const fp_record *) b;
+  unsigned long long hx = (unsigned long long) x->hash, hy = (unsigned long long) y->hash;
+  if (hx != hy) return (hx < hy) ? -1 : 1;
+  if (x->doc != y->doc) return (x->doc < y->doc) ? -1 : 1;
+  return (x->offset < y->offset) ? -1 : (x->offset > y->offset);
+}
+
+/* Sort recs and write them with the document names to path (through a
+   temporary file and rename(), so readers never see half an index).
+   Return 0 if the index could not be written. */
+int
+fp_index_write(const char *path, int k, int winnow, const char *engine, long long modulus,
+               char **names, int ndocs, fp_record *recs, long long nrecs)
+{
+  fp_header h;
+  char *tmp;
+  FILE *f;
+  int fd, ok, i;
+
+  qsort(recs, nrecs, sizeof(fp_record), fp_record_cmp);
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, FP_MAGIC, 4);
+  h.version = FP_VERSION;
+  h.k = k;
+  h.winnow = winnow;
+  h.ndocs = ndocs;
+  strncpy(h.engine, engine, sizeof(h.engine) - 1);
+  h.modulus = modulus;
+  h.nrecs = nrecs;
+  h.names_off = sizeof(fp_header) + sizeof(fp_record) * nrecs;
+
+  tmp = (char *) malloc(strlen(path) + 8);
+  if (!tmp) return 0;
+  sprintf(tmp, "%s.XXXXXX", path);
+  fd = mkstemp(tmp);
+  if (fd < 0) {
+    free(tmp);
+    return 0;
+  }
+  fchmod(fd, 0644);
+  f = fdopen(fd, "wb");
+  if (!f) {
+    close(fd);
+    unlink(tmp);
+    free(tmp);
+    return 0;
+  }
+  ok = fwrite(&h, sizeof(h), 1, f) == 1
+    && fwrite(recs, sizeof(fp_record), nrecs, f) == (size_t) nrecs;
+  for (i = 0; ok && i < ndocs; i++)
+    ok = fwrite(names[i], 1, strlen(names[i]) + 1, f) == strlen(names[i]) + 1;
+  ok = (fclose(f) == 0) && ok;
+  if (ok)
+    ok = rename(tmp, path) == 0;
+  if (!ok)
+    unlink(tmp);
+  free(tmp);
+  return ok;
+}
+
+/* Map the index at path. Return 0 (after saying why) if it is not one. */
+int
+fp_index_open(const char *path, fp_index *ix)
+{
+  struct stat st;
+  const fp_header *h;
+  const fp_record *recs;
+  const char *p, *end;
+  void *map;
+  long long j;
+  int fd, i;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0) {
+    perror("fp_index_open: open ");
+    return 0;
+  }
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(fp_header)) {
+    fprintf(stderr, "%s: not a k-gram index\n", path);
+    close(fd);
+    return 0;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    perror("fp_index_open: mmap ");
+    return 0;
+  }
+  h = (const fp_header *) map;
+  if (memcmp(h->magic, FP_MAGIC, 4) != 0 || h->version != FP_VERSION
+      || h->k < 1 || h->nrecs < 0 || h->ndocs < 0 || h->winnow < 1
+      || h->names_off != (long long) (sizeof(fp_header) + sizeof(fp_record) * h->nrecs)
+      || h->names_off > (long long) st.st_size) {
+    fprintf(stderr, "%s: not a k-gram index (or a different version)\n", path);
+    munmap(map, st.st_size);
+    return 0;
+  }
+
+  ix->names = (char **) malloc(sizeof(char *) * (h->ndocs > 0 ? h->ndocs : 1));
+  if (!ix->names) {
+    fprintf(stderr, "fp_index_open: failed to allocate the name table. No memory\n");
+    exit(1);
+  }
+  p = (const char *) map + h->names_off;
+  end = (const char *) map + st.st_size;
+  for (i = 0; i < h->ndocs; i++) {
+    ix->names[i] = (char *) p;
+    p = memchr(p, 0, end - p);
+    if (!p) {
+      fprintf(stderr, "%s: truncated document names\n", path);
+      free(ix->names);
+      munmap(map, st.st_size);
+      return 0;
+    }
+    p++;
+  }
+  /* the matcher counts hits per doc id, so every one must name a document */
+  recs = (const fp_record *) ((const char *) map + sizeof(fp_header));
+  for (j = 0; j < h->nrecs; j++)
+    if (recs[j].doc < 0 || recs[j].doc >= h->ndocs) {
+      fprintf(stderr, "%s: record %lld names document %d of %d\n", path, j, recs[j].doc, h->ndocs);
+      free(ix->names);
+      munmap(map, st.st_size);
+      return 0;
+    }
+  ix->k = h->k;
+  ix->winnow = h->winnow;
+  memcpy(ix->engine, h->engine, sizeof(ix->engine));
+  ix->engine[sizeof(ix->engine) - 1] = 0;
+  ix->modulus = h->modulus;
+  ix->ndocs = h->ndocs;
+  ix->recs = recs;
+  ix->nrecs = h->nrecs;
+  ix->map = map;
+  ix->map_len = st.st_size;
+  /* lookups land anywhere in the table */
+  madvise(map, st.st_size, MADV_RANDOM);
+  return 1;
+}
+
+void
+fp_index_close(fp_index *ix)
+{
+  free(ix->names);
+  munmap(ix->map, ix->map_len);
+  ix->names = NULL;
+  ix->map = NULL;
+}
+
+/* Return the first record with this hash, or -1 if there is none.
+   Interpolation steps alternate with halving ones, so skewed hashes
+   still take O(log n) steps, while uniform ones take about log log n. */
+long long
+fp_index_find(const fp_index *ix, long long hash)
+{
+  const fp_record *r = ix->recs;
+  unsigned long long key = (unsigned long long) hash, klo, khi;
+  long long lo = 0, hi = ix->nrecs, mid;
+  int step = 0;
+
+  /* invariant: hashes before lo are < key, those from hi on are >= key */
+  while (hi - lo > 8)
+  {
+    klo = (unsigned long long) r[lo].hash;
+    khi = (unsigned long long) r[hi-1].hash;
+    if (key <= klo) {
+      hi = lo;
+      break;
+    }
+    if (key > khi) {
+      lo = hi;
+      break;
+    }
+    if (step++ & 1)
+      mid = lo + (hi - lo) / 2;
+    else
+      mid = lo + (long long) ((unsigned __int128) (key - klo) * (hi - 1 - lo) / (khi - klo));
+    if ((unsigned long long) r[mid].hash < key)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  while (lo < hi && (unsigned long long) r[lo].hash < key) lo++;
+  return (lo < ix->nrecs && r[lo].hash == hash) ? lo : -1;
+}
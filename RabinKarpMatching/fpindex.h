@@ -0,0 +1,33 @@
+/***********************************************************
+ File Name: fpindex.h
+ Description: on-disk index of the k-gram RK hashes of a corpus,
+              written by rkindex and probed by rkmatch -i
+ **********************************************************/
+
+/* one k-gram: document doc has a window with this RK hash at offset */
+typedef struct {
+	long long hash;
+	int doc;
+	long long offset; /* in the normalized document */
+} fp_record;
+
+/* an index mapped by fp_index_open() */
+typedef struct {
+	int k;
+	int winnow;           /* the records are winnowed fingerprints if > 1 */
+	char engine[16];      /* the rkhash engine the hashes come from */
+	long long modulus;    /* BIG_PRIME, for the prime engine */
+	int ndocs;
+	char **names;         /* document names, in doc id order */
+	const fp_record *recs;/* sorted by (unsigned) hash, doc, offset */
+	long long nrecs;
+	void *map;
+	size_t map_len;
+} fp_index;
+
+int fp_index_write(const char *path, int k, int winnow, const char *engine, long long modulus,
+                   char **names, int ndocs, fp_record *recs, long long nrecs);
+int fp_index_open(const char *path, fp_index *ix);
+void fp_index_close(fp_index *ix);
+
+long long fp_index_find(const fp_index *ix, long long hash);
@@ -0,0 +1,381 @@
+/***********************************************************
+ Normalization of query and target documents.
+ normalize_to() dispatches at runtime to an SSE2 or AVX2 kernel
+ that classifies 16 or 32 bytes at a time; normalize_to_scalar()
+ is the reference they must match byte for byte.
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "normalize.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define NORMALIZE_SIMD 1
+#endif
+
+/* The normalize procedure examines a character array of size len
+	 in ONE PASS and does the following:
+	 1) turn all upper case letters into lower case ones
+	 2) turn any white-space character into a space character and,
+	    shrink any n>1 consecutive spaces into exactly 1 space only
+			Hint: use C library function isspace()
+	 The normalized string is written to dst, which may be src itself
+	 (dst never runs ahead of src), so src can be a read-only mapping.
+	 The return value is the length of the normalized string.
+*/
+long long
+normalize_to_scalar(char *dst,				/* where the normalized string is written */
+										const char *src,	/* The character array containing the string to be normalized*/
+										long long len				/* the size of the original character array */)
+{
+  long long i = 0, j = 0;
+  /* Remove leading Whitespace*/
+  while(i < len && src[i] >= 0 && src[i] <= 32) i++;
+  while(i < len)
+  {
+      /* If the letter is capitalized,
+             change it's ascii value to the lowercase equivalent */
+      if (src[i] >= 'A' && src[i] <= 'Z')
+      {
+	dst[j++] = src[i] + 32;
+      }
+      /* Change all weird spaces to space*/
+      else if (src[i] >= 0 && src[i] <= 32)
+      {
+	/* only add the space if it is singular*/
+	if((src[i-1] >= 0 && src[i-1] <= 32) == 0) dst[j++] = 32;
+      }
+      /*if nothing is weird just insert the value*/
+      else
+      {
+	dst[j++] = src[i];
+      }
+      i++;
+  }
+  /* Remove Trailing Whitespace*/
+  while(j > 0 && dst[j-1] >= 0 && dst[j-1] <= 32) j--;
+  /* terminate only inside the buffer: a mapping may end exactly at len */
+  if (j < len) dst[j] = 0;
+  return j;
+}
+
+#ifdef NORMALIZE_SIMD
+
+/* Finish src[i..len) one byte at a time after a vector kernel has written
+	 j bytes. prev_ws says whether src[i-1] was whitespace; it is tracked
+	 here rather than re-read because the kernels may have overwritten it. */
+static long long
+normalize_tail(char *dst, const char *src, long long i, long long j, long long len, unsigned int prev_ws)
+{
+  for (; i < len; i++)
+  {
+    if (src[i] >= 0 && src[i] <= 32)
+    {
+      if (!prev_ws) dst[j++] = 32;
+      prev_ws = 1;
+    }
+    else
+    {
+      dst[j++] = (src[i] >= 'A' && src[i] <= 'Z') ? src[i] + 32 : src[i];
+      prev_ws = 0;
+    }
+  }
+  while(j > 0 && dst[j-1] >= 0 && dst[j-1] <= 32) j--;
+  if (j < len) dst[j] = 0;
+  return j;
+}
+
+/* Both kernels work on a bitmask of whitespace lanes: lane b is dropped
+	 when it and the byte before it are both whitespace. Every store lands
+	 at or before the bytes already loaded, so dst may equal src. */
+
+int
+normalize_has_sse2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+
+__attribute__((target("sse2")))
+long long
+normalize_to_sse2(char *dst, const char *src, long long len)
+{
+  const __m128i minus1 = _mm_set1_epi8(-1), c33 = _mm_set1_epi8(33);
+  const __m128i ca = _mm_set1_epi8('A' - 1), cz = _mm_set1_epi8('Z' + 1);
+  const __m128i c32 = _mm_set1_epi8(32);
+  __m128i v, is_ws, is_up, out;
+  unsigned int ws, keep, prev_ws = 1;
+  char tmp[16];
+  long long i = 0, j = 0;
+
+  while(i < len && src[i] >= 0 && src[i] <= 32) i++;
+  for (; i + 16 <= len; i += 16)
+  {
+    v = _mm_loadu_si128((const __m128i *) &src[i]);
+    is_ws = _mm_and_si128(_mm_cmpgt_epi8(v, minus1), _mm_cmplt_epi8(v, c33));
+    is_up = _mm_and_si128(_mm_cmpgt_epi8(v, ca), _mm_cmplt_epi8(v, cz));
+    out = _mm_add_epi8(v, _mm_and_si128(is_up, c32));
+    out = _mm_or_si128(_mm_andnot_si128(is_ws, out), _mm_and_si128(is_ws, c32));
+
+    ws = (unsigned int) _mm_movemask_epi8(is_ws);
+    keep = ~(ws & ((ws << 1) | prev_ws)) & 0xffff;
+    prev_ws = ws >> 15;
+    if (keep == 0xffff) {
+      _mm_storeu_si128((__m128i *) &dst[j], out);
+      j += 16;
+    } else {
+      /* SSE2 has no byte shuffle: pick the kept lanes one by one */
+      _mm_storeu_si128((__m128i *) tmp, out);
+      while (keep) {
+        dst[j++] = tmp[__builtin_ctz(keep)];
+        keep &= keep - 1;
+      }
+    }
+  }
+  return normalize_tail(dst, src, i, j, len, prev_ws);
+}
+
+/* shuf_table[m] gathers the lanes set in the 8-bit mask m to the front
+	 of an 8-byte group; unused positions are 0x80, which pshufb zeroes. */
+static unsigned long long shuf_table[256];
+static pthread_once_t shuf_once = PTHREAD_ONCE_INIT;
+
+static void
+build_shuf_table(void)
+{
+  int m, b, n;
+  for (m = 0; m < 256; m++)
+  {
+    shuf_table[m] = 0x8080808080808080ULL;
+    for (b = 0, n = 0; b < 8; b++)
+    {
+      if (m & (1 << b)) {
+        shuf_table[m] &= ~(0xffULL << (8 * n));
+        shuf_table[m] |= (unsigned long long) b << (8 * n);
+        n++;
+      }
+    }
+  }
+}
+
+int
+normalize_has_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt");
+}
+
+/* Compact the kept lanes of 16 bytes to dst[j...] as two 8-byte groups,
+	 return the new j */
+__attribute__((target("avx2,popcnt")))
+static inline long long
+compact16(char *dst, long long j, __m128i x, unsigned int keep)
+{
+  /* the high group's indices are offset by 8; 0x80 + 8 still zeroes */
+  __m128i shuf = _mm_set_epi64x((long long) (shuf_table[keep >> 8] + 0x0808080808080808ULL),
+                                (long long) shuf_table[keep & 0xff]);
+  x = _mm_shuffle_epi8(x, shuf);
+  _mm_storel_epi64((__m128i *) &dst[j], x);
+  j += __builtin_popcount(keep & 0xff);
+  _mm_storel_epi64((__m128i *) &dst[j], _mm_srli_si128(x, 8));
+  return j + __builtin_popcount(keep >> 8);
+}
+
+__attribute__((target("avx2,popcnt")))
+long long
+normalize_to_avx2(char *dst, const char *src, long long len)
+{
+  const __m256i minus1 = _mm256_set1_epi8(-1), c33 = _mm256_set1_epi8(33);
+  const __m256i ca = _mm256_set1_epi8('A' - 1), cz = _mm256_set1_epi8('Z' + 1);
+  const __m256i c32 = _mm256_set1_epi8(32);
+  __m256i v, is_ws, is_up, out;
+  unsigned int ws, keep, prev_ws = 1;
+  long long i = 0, j = 0;
+
+  pthread_once(&shuf_once, build_shuf_table);
+  while(i < len && src[i] >= 0 && src[i] <= 32) i++;
+  for (; i + 32 <= len; i += 32)
+  {
+    v = _mm256_loadu_si256((const __m256i *) &src[i]);
+    is_ws = _mm256_and_si256(_mm256_cmpgt_epi8(v, minus1), _mm256_cmpgt_epi8(c33, v));
+    is_up = _mm256_and_si256(_mm256_cmpgt_epi8(v, ca), _mm256_cmpgt_epi8(cz, v));
+    out = _mm256_add_epi8(v, _mm256_and_si256(is_up, c32));
+    out = _mm256_blendv_epi8(out, c32, is_ws);
+
+    ws = (unsigned int) _mm256_movemask_epi8(is_ws);
+    keep = ~(ws & ((ws << 1) | prev_ws));
+    prev_ws = ws >> 31;
+    if (keep == 0xffffffffU) {
+      _mm256_storeu_si256((__m256i *) &dst[j], out);
+      j += 32;
+    } else {
+      j = compact16(dst, j, _mm256_castsi256_si128(out), keep & 0xffff);
+      j = compact16(dst, j, _mm256_extracti128_si256(out, 1), keep >> 16);
+    }
+  }
+  return normalize_tail(dst, src, i, j, len, prev_ws);
+}
+
+#else
+
+int normalize_has_sse2(void) { return 0; }
+int normalize_has_avx2(void) { return 0; }
+
+long long
+normalize_to_sse2(char *dst, const char *src, long long len)
+{
+  return normalize_to_scalar(dst, src, len);
+}
+
+long long
+normalize_to_avx2(char *dst, const char *src, long long len)
+{
+  return normalize_to_scalar(dst, src, len);
+}
+
+#endif
+
+/* Normalize src into dst with the widest kernel this CPU supports */
+long long
+normalize_to(char *dst, const char *src, long long len)
+{
+  if (normalize_has_avx2())
+    return normalize_to_avx2(dst, src, len);
+  if (normalize_has_sse2())
+    return normalize_to_sse2(dst, src, len);
+  return normalize_to_scalar(dst, src, len);
+}
+
+/* You must do the normalization IN PLACE so that when the procedure
+	 returns, the character array buf contains the normalized string and
+	 the return value is the length of the normalized string.
+*/
+long long
+normalize(char *buf,	/* The character array containing the string to be normalized*/
+					long long len	/* the size of the original character array */)
+{
+  /* A new buffer must be created in order to remove spaces without massive cost
+     If it is attempted to do the normalization in place the cost is roughly 30 times greater
+     since an additional for loop is required to do the space removal*/
+  return normalize_to(buf, buf, len);
+}
+
+/* Normalize one block of a document that is read piece by piece.
+	 Runs of whitespace are collapsed across block boundaries by deferring
+	 the space until the next non-space byte shows up, which also drops
+	 leading and trailing whitespace exactly like normalize().
+	 The block itself goes through normalize_to(), so it gets the SIMD
+	 kernels; only the space owed to the previous block is added here.
+	 dst must have room for len+1 bytes and must not overlap src, which
+	 can be a read-only mapping. Return the number of bytes written.
+	 */
+long long
+normalize_block(norm_state *st, char *dst, const char *src, long long len)
+{
+  long long j;
+  int lead;
+
+  if (len <= 0) return 0;
+  /* the space separating this block's first word from the last one */
+  lead = st->started && (st->pending_space || (src[0] >= 0 && src[0] <= 32));
+  j = normalize_to(dst + lead, src, len);
+  if (j == 0) {
+    /* nothing but whitespace */
+    st->pending_space = 1;
+    return 0;
+  }
+  if (lead) {
+    dst[0] = 32;
+    j++;
+  }
+  st->started = 1;
+  st->pending_space = (src[len-1] >= 0 && src[len-1] <= 32);
+  return j;
+}
+
+/* One thread's slice of normalize_parallel() */
+typedef struct {
+	char *dst;
+	const char *src;
+	long long len;
+	long long out_len;  /* normalized length of the slice */
+	int lead_ws;        /* the slice starts with whitespace */
+	int trail_ws;       /* the slice ends with whitespace */
+} norm_slice;
+
+static void *
+normalize_slice(void *arg)
+{
+  norm_slice *sl = (norm_slice *) arg;
+  /* recorded first: in place, the slice's own output overwrites them */
+  sl->lead_ws = sl->len > 0 && sl->src[0] >= 0 && sl->src[0] <= 32;
+  sl->trail_ws = sl->len > 0 && sl->src[sl->len-1] >= 0 && sl->src[sl->len-1] <= 32;
+  sl->out_len = normalize_to(sl->dst, sl->src, sl->len);
+  return NULL;
+}
+
+/* normalize_to() with nthreads threads. Each thread normalizes its own
+	 slice of src into the same place of dst, which drops the whitespace at
+	 both ends of the slice. A serial pass then adds up the slice lengths
+	 into output offsets, memmove()s each slice down to its offset and puts
+	 back the one space a whitespace run across a slice boundary collapses
+	 to. A slice moves at most one byte to the right (for that space, which
+	 it trimmed from its own start) and never past its own end, so moving
+	 the slices in order never overwrites one not yet moved.
+	 The result is byte-identical to normalize_to(), and dst may be src.
+	 */
+long long
+normalize_parallel(char *dst, const char *src, long long len, int nthreads)
+{
+  norm_slice *sl;
+  pthread_t *tids;
+  long long per_thread, off, j = 0;
+  int t, space, ws_since = 0;
+
+  if (nthreads <= 1 || len < nthreads)
+    return normalize_to(dst, src, len);
+  sl = (norm_slice *) malloc(sizeof(norm_slice) * nthreads);
+  tids = (pthread_t *) malloc(sizeof(pthread_t) * nthreads);
+  if (!sl || !tids) {
+    fprintf(stderr, "normalize_parallel: failed to allocate %d threads. No memory\n", nthreads);
+    exit(1);
+  }
+  per_thread = len / nthreads;
+  for (t = 0; t < nthreads; t++)
+  {
+    off = t * per_thread;
+    sl[t].dst = dst + off;
+    sl[t].src = src + off;
+    sl[t].len = (t == nthreads - 1) ? len - off : per_thread;
+    if (pthread_create(&tids[t], NULL, normalize_slice, &sl[t]) != 0) {
+      perror("normalize_parallel: pthread_create ");
+      exit(1);
+    }
+  }
+  for (t = 0; t < nthreads; t++)
+    pthread_join(tids[t], NULL);
+
+  for (t = 0; t < nthreads; t++)
+  {
+    if (sl[t].out_len == 0) {
+      /* nothing but whitespace */
+      ws_since = 1;
+      continue;
+    }
+    space = j > 0 && (ws_since || sl[t].lead_ws);
+    if (sl[t].dst != dst + j + space)
+      memmove(dst + j + space, sl[t].dst, sl[t].out_len);
+    if (space)
+      dst[j] = 32;
+    j += space + sl[t].out_len;
+    ws_since = sl[t].trail_ws;
+  }
+  if (j < len) dst[j] = 0;
+  free(sl);
+  free(tids);
+  return j;
+}
@@ -0,0 +1,24 @@
+/***********************************************************
+ File Name: normalize.h
+ Description: definition of the document normalization functions
+ **********************************************************/
+
+/* What normalize_block() carries from one block of a document to the next */
+typedef struct {
+	int started;        /* a non-space byte has been written */
+	int pending_space;  /* whitespace was seen after the last written byte */
+} norm_state;
+
+long long normalize(char *buf, long long len);
+long long normalize_to(char *dst, const char *src, long long len);
+long long normalize_block(norm_state *st, char *dst, const char *src, long long len);
+long long normalize_parallel(char *dst, const char *src, long long len, int nthreads);
+
+/* The individual kernels behind normalize_to(). All of them produce
+   byte-identical output; normalize_to() picks the fastest one the CPU
+   supports. The scalar one is the reference. */
+long long normalize_to_scalar(char *dst, const char *src, long long len);
+long long normalize_to_sse2(char *dst, const char *src, long long len);
+long long normalize_to_avx2(char *dst, const char *src, long long len);
+int normalize_has_sse2(void);
+int normalize_has_avx2(void);
@@ -0,0 +1,154 @@
+/***********************************************************
+ File Name: normalize_test.c
+ Description: differential test of the normalize kernels against
+              the scalar reference normalize_to_scalar()
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "normalize.h"
+
+typedef long long (*normalize_fn)(char *dst, const char *src, long long len);
+
+/* the byte mixes inputs are drawn from */
+const char *LETTERS = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+const char WHITESPACE[] = { ' ', ' ', ' ', '\t', '\n', '\r', 0, 1, 31, 32 };
+
+/* Fill buf with len random bytes: mostly words separated by whitespace runs
+	 of random length, with some arbitrary (including negative) bytes mixed in */
+void
+fill_random(char *buf, int len, int space_pct)
+{
+	int i;
+	for (i = 0; i < len; i++) {
+		int r = random() % 100;
+		if (r < space_pct) {
+			buf[i] = WHITESPACE[random() % sizeof(WHITESPACE)];
+		} else if (r < 95) {
+			buf[i] = LETTERS[random() % 52];
+		} else {
+			buf[i] = (char) random();
+		}
+	}
+}
+
+/* Run fn on src both out of place and in place,
+	 and compare with the reference output ref of length ref_len */
+int
+check_kernel(const char *name, normalize_fn fn, const char *src, int len,
+		const char *ref, int ref_len)
+{
+	char *buf = (char *) malloc(len + 1);
+	int n;
+
+	memset(buf, 0x55, len + 1);
+	n = fn(buf, src, len);
+	if (n != ref_len || memcmp(buf, ref, n) != 0) {
+		printf("%s differs from the reference out of place (len %d: got %d, expected %d)\n",
+				name, len, n, ref_len);
+		return 0;
+	}
+
+	memcpy(buf, src, len);
+	n = fn(buf, buf, len);
+	if (n != ref_len || memcmp(buf, ref, n) != 0) {
+		printf("%s differs from the reference in place (len %d: got %d, expected %d)\n",
+				name, len, n, ref_len);
+		return 0;
+	}
+	free(buf);
+	return 1;
+}
+
+/* Feed src to normalize_block() in random pieces and compare */
+int
+check_blocks(const char *src, int len, const char *ref, int ref_len)
+{
+	char *buf = (char *) malloc(len + 1);
+	norm_state st = { 0, 0 };
+	int i = 0, n = 0, piece;
+
+	while (i < len) {
+		piece = 1 + random() % 70;
+		if (piece > len - i) piece = len - i;
+		n += normalize_block(&st, &buf[n], &src[i], piece);
+		i += piece;
+	}
+	if (n != ref_len || memcmp(buf, ref, n) != 0) {
+		printf("normalize_block differs from the reference (len %d: got %d, expected %d)\n",
+				len, n, ref_len);
+		return 0;
+	}
+	free(buf);
+	return 1;
+}
+
+/* Normalize src with 2 to 9 threads, out of place and in place, and compare */
+int
+check_parallel(const char *src, int len, const char *ref, int ref_len)
+{
+	char *buf = (char *) malloc(len + 1);
+	int nthreads = 2 + random() % 8;
+	int n;
+
+	n = normalize_parallel(buf, src, len, nthreads);
+	if (n != ref_len || memcmp(buf, ref, n) != 0) {
+		printf("normalize_parallel differs from the reference out of place "
+				"(len %d, %d threads: got %d, expected %d)\n", len, nthreads, n, ref_len);
+		return 0;
+	}
+	memcpy(buf, src, len);
+	n = normalize_parallel(buf, buf, len, nthreads);
+	if (n != ref_len || memcmp(buf, ref, n) != 0) {
+		printf("normalize_parallel differs from the reference in place "
+				"(len %d, %d threads: got %d, expected %d)\n", len, nthreads, n, ref_len);
+		return 0;
+	}
+	free(buf);
+	return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	int iterations = 20000;
+	int i, len, ref_len, ok = 1;
+	char *src, *ref;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		srandom(atoi(argv[2]));
+	}
+
+	src = (char *) malloc(4096);
+	ref = (char *) malloc(4096 + 1);
+	for (i = 0; i < iterations && ok; i++) {
+		/* mostly short inputs, so that every head/tail split is hit */
+		len = (i % 10 == 0) ? random() % 4096 : random() % 200;
+		fill_random(src, len, (int)(random() % 100));
+		ref_len = normalize_to_scalar(ref, src, len);
+
+		ok = check_blocks(src, len, ref, ref_len);
+		/* thread startup dominates: every 4th input is plenty */
+		if (ok && i % 4 == 0)
+			ok = check_parallel(src, len, ref, ref_len);
+		if (ok && normalize_has_sse2())
+			ok = check_kernel("sse2", normalize_to_sse2, src, len, ref, ref_len);
+		if (ok && normalize_has_avx2())
+			ok = check_kernel("avx2", normalize_to_avx2, src, len, ref, ref_len);
+		if (ok)
+			ok = check_kernel("normalize_to", normalize_to, src, len, ref, ref_len);
+	}
+
+	if (!ok) {
+		exit(1);
+	}
+	printf("normalize: %d inputs identical to the scalar reference (sse2 %s, avx2 %s)\n",
+			iterations, normalize_has_sse2() ? "checked" : "unsupported",
+			normalize_has_avx2() ? "checked" : "unsupported");
+	return 0;
+}
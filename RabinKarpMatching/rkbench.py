@@ -0,0 +1,265 @@
+#!/usr/bin/env python
+# Benchmarks for rkmatch. Each benchmark generates its own inputs under
+# bench_data/ and prints one row per configuration.
+#
+#   ./rkbench.py loaders [size_mb]
+#   ./rkbench.py hashes [size_mb] [k]
+#   ./rkbench.py algos [size_mb] [k]
+#   ./rkbench.py winnow [size_mb] [k]
+#   ./rkbench.py shiftor [size_mb] [query_kb]
+#   ./rkbench.py skip [size_mb] [query_kb]
+#   ./rkbench.py fused [size_mb] [k]
+
+from __future__ import print_function
+import subprocess, random, sys, os, re, time
+
+DATA = 'bench_data'
+RUNS = 3
+LETTERS = 'abcdefghijklmnopqrstuvwxyz'
+
+def get_rand_string(size, alphabet=LETTERS):
+	s = []
+	wlen = 0
+	while len(s) < size:
+		if (random.random() < 0.1 or wlen > 14):
+			s.append(' ')
+			wlen = 0
+		else:
+			s.append(random.choice(alphabet))
+			wlen += 1
+	return ''.join(s)
+
+def get_denormalized(orig):
+	s = []
+	for c in orig:
+		if (random.random() < 0.5):
+			s.append(c)
+		else:
+			s.append(c.upper())
+		if (c == ' '):
+			s.append('\t')
+	return ''.join(s)
+
+def data_path(fname):
+	if not os.path.isdir(DATA):
+		os.mkdir(DATA)
+	return os.path.join(DATA, fname)
+
+def make_file(fname, size, alphabet=LETTERS):
+	"""write a denormalized random document of about size bytes, reusing it if present"""
+	path = data_path(fname)
+	if os.path.exists(path) and os.path.getsize(path) >= size:
+		return path
+	block = get_denormalized(get_rand_string(1 << 20, alphabet))
+	f = open(path, 'w')
+	written = 0
+	while written < size:
+		f.write(block)
+		written += len(block)
+	f.close()
+	return path
+
+def drop_cache(path):
+	"""evict path from the page cache so the next run reads it cold (best effort)"""
+	if hasattr(os, 'posix_fadvise'):
+		fd = os.open(path, os.O_RDONLY)
+		os.posix_fadvise(fd, 0, 0, os.POSIX_FADV_DONTNEED)
+		os.close(fd)
+		return True
+	return False
+
+def make_query(doc, size, alphabet=LETTERS):
+	"""a query whose first half is copied from doc and second half is new text"""
+	path = data_path('%s.query%d' % (os.path.basename(doc), size))
+	if not os.path.exists(path):
+		f = open(doc)
+		copied = f.read(size // 2)
+		f.close()
+		f = open(path, 'w')
+		f.write(copied + get_denormalized(get_rand_string(size // 2, alphabet)))
+		f.close()
+	return path
+
+def run_timed(args):
+	"""run rkmatch -T, return the list of per-document timing dicts it reports"""
+	p = subprocess.Popen(["./rkmatch", "-T"] + args, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+	[out, err] = p.communicate()
+	if p.wait() != 0:
+		print("rkmatch %s failed:\n%s" % (' '.join(args), err.decode()))
+		sys.exit(1)
+	rows = []
+	for line in err.decode().splitlines():
+		row = {}
+		for (key, val) in re.findall(r'([a-z][a-z ]*?) ([0-9.]+) ms', line):
+			row[key.strip()] = float(val)
+		for (val, key) in re.findall(r'(\d+) (windows|bloom hits|matched|bits|chunks|fingerprints)', line):
+			row[key] = int(val)
+		if row:
+			rows.append(row)
+	return rows
+
+def bench_loaders(size_mb=256):
+	size = int(size_mb) << 20
+	# a query shorter than k has no chunks, so only loading is measured
+	query = data_path('empty')
+	open(query, 'w').close()
+	doc = make_file('doc%d' % int(size_mb), size)
+	cold = drop_cache(doc)
+	print("time-to-first-hash on a %d MB document (%s cache), best of %d" %
+			(int(size_mb), cold and "cold" or "warm", RUNS))
+	print("%-8s %12s %12s" % ("loader", "load ms", "first hash ms"))
+	for loader in ["read", "mmap"]:
+		best = None
+		for r in range(RUNS):
+			drop_cache(doc)
+			row = run_timed(["-l", loader, "-t", "0", query, doc])[-1]
+			if best is None or row['first hash'] < best['first hash']:
+				best = row
+		print("%-8s %12.2f %12.2f" % (loader, best['load'], best['first hash']))
+
+def bench_hashes(size_mb=32, k=100):
+	doc = make_file('doc%d' % int(size_mb), int(size_mb) << 20)
+	query = make_query(doc, 256 << 10)
+	print("rolling hash engines over a %d MB document, k=%d, best of %d" % (int(size_mb), int(k), RUNS))
+	print("%-8s %12s %12s %12s %14s %14s" % ("engine", "Mhashes/s", "lanes Mh/s", "RKBATCH ms",
+			"verified %", "false hits"))
+	for engine in ["prime", "m61", "wrap64", "buz"]:
+		best = None
+		for r in range(RUNS):
+			row = run_timed(["-H", engine, "-t", "2", "-k", str(k), query, doc])[-1]
+			if best is None or row['hash pass'] < best['hash pass']:
+				best = row
+		lanes = "-"
+		if 'lane hash pass' in best:
+			lanes = "%.1f" % (best['windows'] / best['lane hash pass'] / 1000.0)
+		print("%-8s %12.1f %12s %12.2f %14.4f %14d" % (engine,
+				best['windows'] / best['hash pass'] / 1000.0, lanes, best['match'],
+				100.0 * best['bloom hits'] / best['windows'], best['bloom hits'] - best['matched']))
+
+def bench_algos(size_mb=4, k=50):
+	doc = make_file('doc%d' % int(size_mb), int(size_mb) << 20)
+	query = make_query(doc, 64 << 10)
+	inputs = [("X/Y", "X", "Y"), ("%d MB" % int(size_mb), query, doc)]
+	print("matching algorithms, k=%d, best of %d" % (int(k), RUNS))
+	print("%-8s %-10s %12s %12s" % ("input", "algorithm", "match ms", "matched"))
+	for (name, x, y) in inputs:
+		for (t, algo) in [(0, "SIMPLE"), (1, "RK"), (2, "RKBATCH"), (3, "AC"), (4, "SA")]:
+			best = None
+			for r in range(RUNS):
+				row = run_timed(["-t", str(t), "-k", str(k), x, y])[-1]
+				if best is None or row['match'] < best['match']:
+					best = row
+			print("%-8s %-10s %12.2f %12d" % (name, algo, best['match'], best['matched']))
+
+def bench_winnow(size_mb=4, k=50):
+	"""RKBATCH over every k-gram (w=1) and winnowed with growing windows:
+	filter size and match time against the share of the query's
+	fingerprints still found, relative to w=1"""
+	doc = make_file('doc%d' % int(size_mb), int(size_mb) << 20)
+	query = make_query(doc, 64 << 10)
+	print("winnowed RKBATCH, %d MB, k=%d, best of %d" % (int(size_mb), int(k), RUNS))
+	print("%6s %12s %12s %12s %10s %10s" % ("w", "bloom bits", "fingerprints", "match ms", 
+		"found", "vs w=1"))
+	full = None
+	for w in [1, 4, 8, 16, 32]:
+		best = None
+		for r in range(RUNS):
+			rows = run_timed(["-t", "2", "-k", str(k), "-w", str(w), query, doc])
+			if best is None or rows[-1]['match'] < best[1]['match']:
+				best = (rows[0], rows[-1])
+		(bf, row) = best
+		found = float(row['matched']) / bf['fingerprints']
+		if full is None:
+			full = found
+		print("%6d %12d %12d %12.2f %10.3f %10.3f" % (w, bf['bits'], bf['fingerprints'], 
+			row['match'], found, found / full if full else 0))
+
+def bench_shiftor(size_mb=1, query_kb=4):
+	"""Shift-Or against the other exact algorithms for the short chunks
+	it supports. Its work per byte grows with the number of chunks, so
+	the query is kept small."""
+	doc = make_file('doc%d' % int(size_mb), int(size_mb) << 20)
+	query = make_query(doc, int(query_kb) << 10)
+	print("short chunks, %d MB, %d KB query, best of %d" % (int(size_mb), int(query_kb), RUNS))
+	print("%4s %-10s %12s %12s" % ("k", "algorithm", "match ms", "matched"))
+	for k in [8, 16, 32, 64]:
+		for (t, algo) in [(0, "SIMPLE"), (1, "RK"), (3, "AC"), (5, "SHIFTOR")]:
+			best = None
+			for r in range(RUNS):
+				row = run_timed(["-t", str(t), "-k", str(k), query, doc])[-1]
+				if best is None or row['match'] < best['match']:
+					best = row
+			print("%4d %-10s %12.2f %12d" % (k, algo, best['match'], best['matched']))
+
+def bench_skip(size_mb=1, query_kb=2):
+	"""the per-chunk searches (SIMPLE, RK and the skipping Horspool and
+	Two-Way) and RKBATCH as k grows, on text drawn from alphabets of 2,
+	4 and 26 letters (between the words' spaces)"""
+	print("per-chunk search, %d MB, %d KB query, best of %d" % (int(size_mb), int(query_kb), RUNS))
+	print("%-9s %4s %-10s %12s %12s" % ("alphabet", "k", "algorithm", "match ms", "matched"))
+	for letters in [2, 4, 26]:
+		alphabet = LETTERS[:letters]
+		doc = make_file('doc%d.a%d' % (int(size_mb), letters), int(size_mb) << 20, alphabet)
+		query = make_query(doc, int(query_kb) << 10, alphabet)
+		for k in [8, 32, 100, 400]:
+			for (t, algo) in [(0, "SIMPLE"), (1, "RK"), (2, "RKBATCH"), (6, "HORSPOOL"), (7, "TWOWAY")]:
+				best = None
+				for r in range(RUNS):
+					row = run_timed(["-t", str(t), "-k", str(k), query, doc])[-1]
+					if best is None or row['match'] < best['match']:
+						best = row
+				print("%-9s %4d %-10s %12.2f %12d" % ("%d" % letters, k, algo, best['match'], best['matched']))
+
+def bench_fused(size_mb=64, k=50):
+	"""RKBATCH on one thread after loading and normalizing the whole
+	document (read, mmap) and normalizing it block by block as it is
+	hashed (fused)"""
+	doc = make_file('doc%d' % int(size_mb), int(size_mb) << 20)
+	query = make_query(doc, 64 << 10)
+	print("RKBATCH over a %d MB document, k=%d, best of %d" % (int(size_mb), int(k), RUNS))
+	print("%-8s %12s %12s %12s" % ("loader", "load ms", "match ms", "total ms"))
+	for loader in ["read", "mmap", "fused"]:
+		best = None
+		for r in range(RUNS):
+			row = run_timed(["-j", "1", "-l", loader, "-t", "2", "-k", str(k), query, doc])[-1]
+			row['total'] = row.get('load', 0) + row['match']
+			if best is None or row['total'] < best['total']:
+				best = row
+		print("%-8s %12.2f %12.2f %12.2f" % (loader, best.get('load', 0), best['match'], best['total']))
+
+def bench_queries(nqueries=20, size_mb=8, k=50):
+	"""RKBATCH with nqueries queries against one document: one run per
+	query, against all queries at once with -r (wall clock, best of RUNS)"""
+	doc = make_file('doc%d' % int(size_mb), int(size_mb) << 20)
+	queries = [make_query(doc, (16 << 10) + i) for i in range(int(nqueries))]
+	print("%d queries against a %d MB document, k=%d, best of %d" % (int(nqueries), int(size_mb), int(k), RUNS))
+	print("%-12s %12s" % ("mode", "total ms"))
+	runs = [("per query", [["-t", "2", "-k", str(k), q, doc] for q in queries]),
+			("-r", [["-t", "2", "-k", str(k), "-r", doc] + queries])]
+	for (mode, commands) in runs:
+		best = None
+		for r in range(RUNS):
+			t = time.time()
+			for args in commands:
+				run_timed(args)
+			t = (time.time() - t) * 1000.0
+			if best is None or t < best:
+				best = t
+		print("%-12s %12.2f" % (mode, best))
+
+BENCHMARKS = {
+	'loaders': bench_loaders,
+	'hashes': bench_hashes,
+	'algos': bench_algos,
+	'winnow': bench_winnow,
+	'shiftor': bench_shiftor,
+	'skip': bench_skip,
+	'fused': bench_fused,
+	'queries': bench_queries,
+}
+
+if __name__ == '__main__':
+	if len(sys.argv) < 2 or sys.argv[1] not in BENCHMARKS:
+		print("Usage: ./rkbench.py <%s> [args...]" % '|'.join(sorted(BENCHMARKS)))
+		sys.exit(1)
+	BENCHMARKS[sys.argv[1]](*sys.argv[2:])
@@ -0,0 +1,623 @@
+/***********************************************************
+ Rolling hash engines for Rabin-Karp matching.
+   prime  - the original: base 256 modulo BIG_PRIME (-q)
+   m61    - base 256 modulo the Mersenne prime 2^61-1, reduced with
+            shifts and adds instead of a 64-bit division
+   wrap64 - odd base modulo 2^64, i.e. plain wrapping arithmetic
+   buz    - cyclic polynomial (buzhash): rotations and xors of a
+            random per-byte table, no multiplies at all
+ Every engine's rehashValue(k) also fills a 256-entry table of what
+ each outgoing byte takes off the hash (c * 256^(k-1), or its rotated
+ buz entry), so rehash() looks it up instead of multiplying. The prime
+ engine also shifts by 256 through a table (prime_shift8). The tables
+ hold one snippet size at a time; rehash() falls back to computing
+ for any other k.
+ With the lookups, m61 and wrap64 windows are rolled with shifts, adds
+ and (wrap64) one multiply by a constant, which rk_roll_lanes() does
+ for 8 (AVX2) or 16 (AVX-512) stripes of a document at once.
+ **********************************************************/
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "rkhash.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RK_SIMD 1
+#endif
+
+/* a large prime for RK hash (BIG_PRIME*256 does not overflow)*/
+long long BIG_PRIME = 5003943032159437;
+
+/* modulo addition */
+long long
+madd(long long a, long long b)
+{
+	return ((a+b)>BIG_PRIME?(a+b-BIG_PRIME):(a+b));
+}
+
+/* modulo substraction */
+long long
+mdel(long long a, long long b)
+{
+	return ((a>b)?(a-b):(a+BIG_PRIME-b));
+}
+
+/* modulo multiplication*/
+long long
+mmul(long long a, long long b)
+{
+	return ((a*b) % BIG_PRIME);
+}
+
+/* The outgoing-byte terms of one k: v[c] is what rehash() subtracts
+   when byte c leaves the window. k is published last, so a rehash()
+   that sees its own k sees the whole table. */
+typedef struct {
+	int k;
+	long long modulus;    /* BIG_PRIME the table was built for (prime only) */
+	long long v[256];
+} out_table;
+
+static pthread_mutex_t out_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* the table for k, if it is the one built */
+static inline const long long *
+out_lookup(const out_table *t, int k)
+{
+  return __atomic_load_n(&t->k, __ATOMIC_ACQUIRE) == k ? t->v : NULL;
+}
+
+/* Fill t for k with term(hashValue, c) of every byte c, unless it is
+   already; documents matched in parallel all ask for the same k */
+static void
+out_build(out_table *t, int k, long long modulus, long long hashValue,
+          long long (*term)(long long hashValue, char c))
+{
+  int c;
+  pthread_mutex_lock(&out_lock);
+  if (t->k != k || t->modulus != modulus) {
+    __atomic_store_n(&t->k, 0, __ATOMIC_RELEASE);
+    for (c = 0; c < 256; c++)
+      t->v[c] = term(hashValue, (char) c);
+    t->modulus = modulus;
+    __atomic_store_n(&t->k, k, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&out_lock);
+}
+
+/* 256 * x mod BIG_PRIME without the division. With BIG_PRIME < 2^b,
+   x < 2^b splits into its top 8 bits xh and the rest xl, and
+   256x = xh * 2^b + 256 xl, where (xh * 2^b) mod BIG_PRIME comes from
+   shift_tab and 256 xl < 2^b <= 2 BIG_PRIME: the sum is below 
+   3 BIG_PRIME. Anything else (a negative x from a byte above 127) is 
+   left to mmul, so the result is always exactly mmul(256, x). */
+static struct {
+	long long modulus;
+	int bits;             /* b */
+	long long tab[256];
+} shift_tab;
+
+static void
+shift_build(void)
+{
+  int b = 1, i;
+  if (shift_tab.modulus == BIG_PRIME)
+    return;
+  while (b < 62 && (1LL << b) <= BIG_PRIME)
+    b++;
+  for (i = 0; i < 256; i++)
+  {
+    /* i * 2^b mod BIG_PRIME, 2^b as 256 * 2^(b-8) */
+    shift_tab.tab[i] = mmul(mmul((long long) i, 1LL << (b - 8 > 0 ? b - 8 : 0)), 256);
+  }
+  shift_tab.bits = b;
+  shift_tab.modulus = BIG_PRIME;
+}
+
+static inline long long
+prime_shift8(long long x)
+{
+  int b = shift_tab.bits;
+  long long r;
+  if (b <= 8 || x < 0 || x >= (1LL << b))
+    return mmul(256, x);
+  r = shift_tab.tab[x >> (b - 8)] + ((x & ((1LL << (b - 8)) - 1)) << 8);
+  if (r >= 2 * BIG_PRIME) r -= 2 * BIG_PRIME;
+  if (r >= BIG_PRIME) r -= BIG_PRIME;
+  return r;
+}
+
+/*Calculate the Initial hash value*/
+static long long
+prime_hash(const char *ps, int k)
+{
+  long long hashed = 0;
+  int i;
+  /* hash(P [0...k − 1]) =
+256^(k-1)∗ P [0] + 256^(k−2)∗P [1] + ... + 256 ∗P [k − 2] + P [k − 1]]*/
+  for(i = 0; i < k; i++)
+  {
+    hashed = mmul(256, hashed);
+    hashed = madd(hashed, (long long) ps[i]);
+  }
+  return hashed;
+}
+
+/*Calculate the Rolling hash value*/
+static out_table prime_out;
+
+static long long
+prime_rehash(long long previous, long long hashValue, const char *ps, int k)
+{
+  long long rehashed = 0;
+  const long long *out = out_lookup(&prime_out, k);
+  /* Y_(i+1) = 256 ∗ (y_(i)− 256^(k−1)∗Y [i]) + Y [i + k]*/
+  if (out && shift_tab.modulus == BIG_PRIME)
+    return madd(prime_shift8(mdel(previous, out[(unsigned char) ps[0]])), (long long) ps[k]);
+  rehashed = madd(mmul((long long) 256, mdel(previous, mmul(hashValue, (long long) ps[0]))), (long long) ps[k]);
+  return rehashed;
+}
+
+static long long
+prime_term(long long hashValue, char c)
+{
+  return mmul(hashValue, (long long) c);
+}
+
+/* Create and return the power of 256 which will be needed for the rolling hash*/
+static long long
+prime_rehashValue(int k)
+{
+  long long h = 1;
+  int i;
+  /*256^(k-1)*/
+  for(i = 1; i < k; i++)
+  {
+    h = mmul(h, (long long) 256);
+  }
+  pthread_mutex_lock(&out_lock);
+  shift_build();
+  pthread_mutex_unlock(&out_lock);
+  out_build(&prime_out, k, BIG_PRIME, h, prime_term);
+  return h;
+}
+
+/* Mersenne 2^61-1: x mod M61 is (x & M61) + (x >> 61), folded once more */
+#define M61 ((1ULL << 61) - 1)
+
+static unsigned long long
+m61_reduce(unsigned long long x)
+{
+  x = (x & M61) + (x >> 61);
+  return (x >= M61) ? x - M61 : x;
+}
+
+/* 256 * h mod M61: the bits shifted past bit 61 wrap around to the bottom */
+static unsigned long long
+m61_shift8(unsigned long long h)
+{
+  return m61_reduce(((h << 8) & M61) + (h >> 53));
+}
+
+static unsigned long long
+m61_mul(unsigned long long a, unsigned long long b)
+{
+  unsigned __int128 p = (unsigned __int128) a * b;
+  return m61_reduce(((unsigned long long) p & M61) + (unsigned long long) (p >> 61));
+}
+
+static long long
+m61_hash(const char *ps, int k)
+{
+  unsigned long long h = 0;
+  int i;
+  for (i = 0; i < k; i++)
+    h = m61_reduce(m61_shift8(h) + (unsigned char) ps[i]);
+  return (long long) h;
+}
+
+static out_table m61_out;
+
+static long long
+m61_term(long long hashValue, char c)
+{
+  return (long long) m61_mul((unsigned long long) hashValue, (unsigned char) c);
+}
+
+static long long
+m61_rehash(long long previous, long long hashValue, const char *ps, int k)
+{
+  const long long *out = out_lookup(&m61_out, k);
+  unsigned long long h;
+  h = m61_reduce((unsigned long long) previous + M61
+                 - (out ? (unsigned long long) out[(unsigned char) ps[0]]
+                        : m61_mul((unsigned long long) hashValue, (unsigned char) ps[0])));
+  return (long long) m61_reduce(m61_shift8(h) + (unsigned char) ps[k]);
+}
+
+/* 256^(k-1) mod M61 */
+static long long
+m61_rehashValue(int k)
+{
+  unsigned long long h = 1;
+  int i;
+  for (i = 1; i < k; i++)
+    h = m61_shift8(h);
+  out_build(&m61_out, k, 0, (long long) h, m61_term);
+  return (long long) h;
+}
+
+/* Modulo 2^64 the base must be odd: with base 256 every byte older
+   than the last 8 would be shifted out of the hash entirely. */
+#define W64_BASE 0x100000001b3ULL
+
+static long long
+wrap64_hash(const char *ps, int k)
+{
+  unsigned long long h = 0;
+  int i;
+  for (i = 0; i < k; i++)
+    h = h * W64_BASE + (unsigned char) ps[i];
+  return (long long) h;
+}
+
+static out_table wrap64_out;
+
+static long long
+wrap64_term(long long hashValue, char c)
+{
+  return (long long) ((unsigned long long) hashValue * (unsigned char) c);
+}
+
+static long long
+wrap64_rehash(long long previous, long long hashValue, const char *ps, int k)
+{
+  const long long *out = out_lookup(&wrap64_out, k);
+  unsigned long long h = (unsigned long long) previous
+    - (out ? (unsigned long long) out[(unsigned char) ps[0]]
+           : (unsigned long long) hashValue * (unsigned char) ps[0]);
+  return (long long) (h * W64_BASE + (unsigned char) ps[k]);
+}
+
+/* W64_BASE^(k-1) mod 2^64 */
+static long long
+wrap64_rehashValue(int k)
+{
+  unsigned long long h = 1;
+  int i;
+  for (i = 1; i < k; i++)
+    h *= W64_BASE;
+  out_build(&wrap64_out, k, 0, (long long) h, wrap64_term);
+  return (long long) h;
+}
+
+/* buzhash: hash(P) = rotl(T[P[0]], k-1) ^ ... ^ rotl(T[P[k-1]], 0) */
+static unsigned long long buz_table[256];
+
+static unsigned long long
+rotl64(unsigned long long x, int r)
+{
+  r &= 63;
+  return r ? (x << r) | (x >> (64 - r)) : x;
+}
+
+static long long
+buz_hash(const char *ps, int k)
+{
+  unsigned long long h = 0;
+  int i;
+  for (i = 0; i < k; i++)
+    h = rotl64(h, 1) ^ buz_table[(unsigned char) ps[i]];
+  return (long long) h;
+}
+
+static out_table buz_out;
+
+static long long
+buz_term(long long hashValue, char c)
+{
+  return (long long) rotl64(buz_table[(unsigned char) c], (int) hashValue);
+}
+
+static long long
+buz_rehash(long long previous, long long hashValue, const char *ps, int k)
+{
+  const long long *out = out_lookup(&buz_out, k);
+  return (long long) (rotl64((unsigned long long) previous, 1)
+                      ^ (out ? (unsigned long long) out[(unsigned char) ps[0]]
+                             : rotl64(buz_table[(unsigned char) ps[0]], (int) hashValue))
+                      ^ buz_table[(unsigned char) ps[k]]);
+}
+
+/* the outgoing byte has been rotated k times by the time it leaves */
+static long long
+buz_rehashValue(int k)
+{
+  out_build(&buz_out, k, 0, k % 64, buz_term);
+  return k % 64;
+}
+
+/* fill buz_table from a fixed splitmix64 stream, so hashes are stable
+   across runs (and across the query and the documents) */
+static void
+buz_init(void)
+{
+  unsigned long long x = 0x2545F4914F6CDD1DULL, z;
+  int i;
+  for (i = 0; i < 256; i++)
+  {
+    z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    buz_table[i] = z ^ (z >> 31);
+  }
+}
+
+static const rk_engine engines[] = {
+	{ "prime",  prime_hash,  prime_rehash,  prime_rehashValue },
+	{ "m61",    m61_hash,    m61_rehash,    m61_rehashValue },
+	{ "wrap64", wrap64_hash, wrap64_rehash, wrap64_rehashValue },
+	{ "buz",    buz_hash,    buz_rehash,    buz_rehashValue },
+};
+
+const rk_engine *RK_ENGINE = &engines[0];
+const char *RK_ENGINE_NAMES = "prime m61 wrap64 buz";
+
+/* Make 'name' the engine behind hash()/rehash()/rehashValue().
+   Call before any hashing starts. Return 0 if there is no such engine. */
+int
+rk_select_engine(const char *name)
+{
+  unsigned int i;
+  for (i = 0; i < sizeof(engines) / sizeof(engines[0]); i++)
+  {
+    if (strcmp(engines[i].name, name) == 0) {
+      if (engines[i].hash == buz_hash)
+        buz_init();
+      RK_ENGINE = &engines[i];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/* Rolling hashes in SIMD lanes. Lane j holds the hash of window 
+   p + j*stride and each step rolls every lane one window on, for the
+   m61 and wrap64 engines only: their rehash() is the same few
+   operations for every lane once the outgoing byte's term is a table
+   lookup (a gather). The bytes are gathered 4 at a time from inside
+   the windows being rolled (the outgoing byte is the first of 4, the
+   incoming one the last), so no lane reads outside the document;
+   that takes k >= 4. */
+
+int
+rk_has_avx2(void)
+{
+#ifdef RK_SIMD
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#else
+  return 0;
+#endif
+}
+
+int
+rk_has_avx512(void)
+{
+#ifdef RK_SIMD
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+#else
+  return 0;
+#endif
+}
+
+/* the outgoing-byte table rk_roll_lanes() can use for k, or NULL */
+static const long long *
+lanes_table(int k)
+{
+  if (k < 4)
+    return NULL;
+  if (RK_ENGINE->hash == m61_hash)
+    return out_lookup(&m61_out, k);
+  if (RK_ENGINE->hash == wrap64_hash)
+    return out_lookup(&wrap64_out, k);
+  return NULL;
+}
+
+/* the widest kernel this CPU runs, picked once: rk_roll_lanes() is
+   called every few windows */
+static void (*lanes_kernel)(const char *ts, long long p, long long stride, int k,
+                            long long *h, long long *out, int steps);
+static int lanes_width;
+static pthread_once_t lanes_once = PTHREAD_ONCE_INIT;
+
+static void
+pick_lanes_kernel(void)
+{
+  if (rk_has_avx512()) {
+    lanes_kernel = rk_roll_lanes_avx512;
+    lanes_width = 16;
+  } else if (rk_has_avx2()) {
+    lanes_kernel = rk_roll_lanes_avx2;
+    lanes_width = 8;
+  }
+}
+
+/* How many lanes rk_roll_lanes() advances for the engine and k, 0 if it
+   cannot (another engine, k < 4, or rehashValue(k) not called yet) */
+int
+rk_lanes(int k)
+{
+  if (!lanes_table(k))
+    return 0;
+  pthread_once(&lanes_once, pick_lanes_kernel);
+  return lanes_width;
+}
+
+#ifdef RK_SIMD
+
+__attribute__((target("avx2")))
+void
+rk_roll_lanes_avx2(const char *ts, long long p, long long stride, int k,
+                   long long *h, long long *out, int steps)
+{
+  const long long *tab = lanes_table(k);
+  const __m256i m61 = _mm256_set1_epi64x((long long) M61), m61_1 = _mm256_set1_epi64x((long long) M61 - 1);
+  const __m256i lo8 = _mm256_set1_epi64x(0xff), one = _mm256_set1_epi64x(1);
+  const __m256i base_lo = _mm256_set1_epi64x((long long) (W64_BASE & 0xffffffffULL));
+  int is_m61 = RK_ENGINE->hash == m61_hash;
+  __m256i pos[2], hv[2], ob, ib, x, y;
+  int s, v;
+
+  for (v = 0; v < 2; v++)
+  {
+    pos[v] = _mm256_set_epi64x(p + (4*v + 3) * stride, p + (4*v + 2) * stride,
+                               p + (4*v + 1) * stride, p + (4*v) * stride);
+    hv[v] = _mm256_loadu_si256((const __m256i *) &h[4*v]);
+  }
+  for (s = 0; s < steps; s++)
+  {
+    for (v = 0; v < 2; v++)
+    {
+      ob = _mm256_cvtepu32_epi64(_mm256_i64gather_epi32((const int *) ts, pos[v], 1));
+      ob = _mm256_and_si256(ob, lo8);
+      ib = _mm256_cvtepu32_epi64(_mm256_i64gather_epi32((const int *) (ts + k - 3), pos[v], 1));
+      ib = _mm256_srli_epi64(ib, 24);
+      ob = _mm256_i64gather_epi64(tab, ob, 8);
+      if (is_m61) {
+        /* as m61_rehash: reduce(h + M61 - out), shift by 8, add the byte */
+        x = _mm256_sub_epi64(_mm256_add_epi64(hv[v], m61), ob);
+        x = _mm256_add_epi64(_mm256_and_si256(x, m61), _mm256_srli_epi64(x, 61));
+        x = _mm256_sub_epi64(x, _mm256_and_si256(_mm256_cmpgt_epi64(x, m61_1), m61));
+        x = _mm256_add_epi64(_mm256_and_si256(_mm256_slli_epi64(x, 8), m61), _mm256_srli_epi64(x, 53));
+        x = _mm256_add_epi64(_mm256_and_si256(x, m61), _mm256_srli_epi64(x, 61));
+        x = _mm256_sub_epi64(x, _mm256_and_si256(_mm256_cmpgt_epi64(x, m61_1), m61));
+        x = _mm256_add_epi64(x, ib);
+        x = _mm256_add_epi64(_mm256_and_si256(x, m61), _mm256_srli_epi64(x, 61));
+        x = _mm256_sub_epi64(x, _mm256_and_si256(_mm256_cmpgt_epi64(x, m61_1), m61));
+      } else {
+        /* (h - out) * W64_BASE + byte, W64_BASE = 2^40 + its low 32 bits */
+        x = _mm256_sub_epi64(hv[v], ob);
+        y = _mm256_add_epi64(_mm256_mul_epu32(x, base_lo),
+                             _mm256_slli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(x, 32), base_lo), 32));
+        x = _mm256_add_epi64(_mm256_add_epi64(_mm256_slli_epi64(x, 40), y), ib);
+      }
+      hv[v] = x;
+      _mm256_storeu_si256((__m256i *) &out[s*8 + 4*v], x);
+      pos[v] = _mm256_add_epi64(pos[v], one);
+    }
+  }
+  for (v = 0; v < 2; v++)
+    _mm256_storeu_si256((__m256i *) &h[4*v], hv[v]);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+void
+rk_roll_lanes_avx512(const char *ts, long long p, long long stride, int k,
+                     long long *h, long long *out, int steps)
+{
+  const long long *tab = lanes_table(k);
+  const __m512i m61 = _mm512_set1_epi64((long long) M61);
+  const __m512i lo8 = _mm512_set1_epi64(0xff), one = _mm512_set1_epi64(1);
+  const __m512i base = _mm512_set1_epi64((long long) W64_BASE);
+  int is_m61 = RK_ENGINE->hash == m61_hash;
+  __m512i pos[2], hv[2], ob, ib, x;
+  __mmask8 ge;
+  int s, v;
+
+  for (v = 0; v < 2; v++)
+  {
+    pos[v] = _mm512_add_epi64(_mm512_set1_epi64(p + 8*v*stride),
+                              _mm512_mullo_epi64(_mm512_set_epi64(7, 6, 5, 4, 3, 2, 1, 0),
+                                                 _mm512_set1_epi64(stride)));
+    hv[v] = _mm512_loadu_si512(&h[8*v]);
+  }
+  for (s = 0; s < steps; s++)
+  {
+    for (v = 0; v < 2; v++)
+    {
+      ob = _mm512_cvtepu32_epi64(_mm512_i64gather_epi32(pos[v], ts, 1));
+      ob = _mm512_and_si512(ob, lo8);
+      ib = _mm512_cvtepu32_epi64(_mm512_i64gather_epi32(pos[v], ts + k - 3, 1));
+      ib = _mm512_srli_epi64(ib, 24);
+      ob = _mm512_i64gather_epi64(ob, tab, 8);
+      if (is_m61) {
+        x = _mm512_sub_epi64(_mm512_add_epi64(hv[v], m61), ob);
+        x = _mm512_add_epi64(_mm512_and_si512(x, m61), _mm512_srli_epi64(x, 61));
+        ge = _mm512_cmpge_epu64_mask(x, m61);
+        x = _mm512_mask_sub_epi64(x, ge, x, m61);
+        x = _mm512_add_epi64(_mm512_and_si512(_mm512_slli_epi64(x, 8), m61), _mm512_srli_epi64(x, 53));
+        x = _mm512_add_epi64(_mm512_and_si512(x, m61), _mm512_srli_epi64(x, 61));
+        ge = _mm512_cmpge_epu64_mask(x, m61);
+        x = _mm512_mask_sub_epi64(x, ge, x, m61);
+        x = _mm512_add_epi64(x, ib);
+        x = _mm512_add_epi64(_mm512_and_si512(x, m61), _mm512_srli_epi64(x, 61));
+        ge = _mm512_cmpge_epu64_mask(x, m61);
+        x = _mm512_mask_sub_epi64(x, ge, x, m61);
+      } else {
+        x = _mm512_add_epi64(_mm512_mullo_epi64(_mm512_sub_epi64(hv[v], ob), base), ib);
+      }
+      hv[v] = x;
+      _mm512_storeu_si512(&out[s*16 + 8*v], x);
+      pos[v] = _mm512_add_epi64(pos[v], one);
+    }
+  }
+  for (v = 0; v < 2; v++)
+    _mm512_storeu_si512(&h[8*v], hv[v]);
+}
+
+#else
+
+/* rk_lanes() is 0 without the kernels, so nothing may call these */
+void
+rk_roll_lanes_avx2(const char *ts, long long p, long long stride, int k,
+                   long long *h, long long *out, int steps)
+{
+  (void) ts; (void) p; (void) stride; (void) k;
+  (void) h; (void) out; (void) steps;
+  abort();
+}
+
+void
+rk_roll_lanes_avx512(const char *ts, long long p, long long stride, int k,
+                     long long *h, long long *out, int steps)
+{
+  (void) ts; (void) p; (void) stride; (void) k;
+  (void) h; (void) out; (void) steps;
+  abort();
+}
+
+#endif
+
+/* Roll the rk_lanes(k) hashes h[j] of windows p + j*stride on by 'steps' 
+   windows, writing the hash of window p + j*stride + s + 1 to 
+   out[s*lanes + j]. Every window rolled into must exist. */
+void
+rk_roll_lanes(const char *ts, long long p, long long stride, int k,
+              long long *h, long long *out, int steps)
+{
+  pthread_once(&lanes_once, pick_lanes_kernel);
+  lanes_kernel(ts, p, stride, k, h, out, steps);
+}
+
+long long
+hash(const char *ps, int k)
+{
+  return RK_ENGINE->hash(ps, k);
+}
+
+long long
+rehash(long long previous, long long hashValue, const char *ps, int k)
+{
+  return RK_ENGINE->rehash(previous, hashValue, ps, k);
+}
+
+long long
+rehashValue(int k)
+{
+  return RK_ENGINE->rehashValue(k);
+}
@@ -0,0 +1,48 @@
+/***********************************************************
+ File Name: rkhash.h
+ Description: the rolling hash engines behind rkmatch's
+              hash(), rehash() and rehashValue()
+ **********************************************************/
+
+/* A rolling hash over k-byte windows.
+   rehash() rolls the hash of ps[0..k-1] to that of ps[1..k], using the
+   per-k constant computed once by rehashValue(). */
+typedef struct {
+	const char *name;
+	long long (*hash)(const char *ps, int k);
+	long long (*rehash)(long long previous, long long hashValue, const char *ps, int k);
+	long long (*rehashValue)(int k);
+} rk_engine;
+
+/* the modulus of the "prime" engine (-q) */
+extern long long BIG_PRIME;
+
+/* the engine hash(), rehash() and rehashValue() dispatch to (-H) */
+extern const rk_engine *RK_ENGINE;
+extern const char *RK_ENGINE_NAMES;
+
+int rk_select_engine(const char *name);
+
+long long madd(long long a, long long b);
+long long mdel(long long a, long long b);
+long long mmul(long long a, long long b);
+
+long long hash(const char *ps, int k);
+long long rehash(long long previous, long long hashValue, const char *ps, int k);
+long long rehashValue(int k);
+
+/* Hashing several stripes of a document side by side in SIMD lanes
+   (m61 and wrap64, see rkhash.c). rk_lanes(k) is the number of lanes
+   rk_roll_lanes() advances, or 0 if it cannot be used. */
+#define RK_MAX_LANES 16
+int rk_lanes(int k);
+void rk_roll_lanes(const char *ts, long long p, long long stride, int k,
+                   long long *h, long long *out, int steps);
+
+/* The kernels behind rk_roll_lanes(): 8 and 16 lanes */
+void rk_roll_lanes_avx2(const char *ts, long long p, long long stride, int k,
+                        long long *h, long long *out, int steps);
+void rk_roll_lanes_avx512(const char *ts, long long p, long long stride, int k,
+                          long long *h, long long *out, int steps);
+int rk_has_avx2(void);
+int rk_has_avx512(void);
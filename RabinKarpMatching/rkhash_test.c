@@ -0,0 +1,96 @@
+/***********************************************************
+ File Name: rkhash_test.c
+ Description: differential test of the SIMD lane kernels of the
+              m61 and wrap64 engines against hash() of every window
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rkhash.h"
+
+typedef void (*lanes_fn)(const char *ts, long long p, long long stride, int k,
+                         long long *h, long long *out, int steps);
+
+/* Fill buf with len bytes, all 256 values or only a few letters */
+void
+fill_random(char *buf, int len)
+{
+	int i, letters = random() % 2;
+	for (i = 0; i < len; i++)
+		buf[i] = letters ? 'a' + random() % 4 : (char) random();
+}
+
+/* Roll 'lanes' stripes of ts with fn, in calls of up to 7 steps, and
+	 compare every hash with hash() of its window */
+int
+check_kernel(const char *name, lanes_fn fn, int lanes, const char *ts, int n, int k)
+{
+	long long h[RK_MAX_LANES], out[7 * RK_MAX_LANES];
+	int stride = (n - k + 1) / lanes, s, t, j, steps;
+
+	if (stride < 2)
+		return 1;
+	for (j = 0; j < lanes; j++)
+		h[j] = hash(&ts[j*stride], k);
+	for (s = 0; s + 1 < stride; s += steps) {
+		steps = 1 + random() % 7;
+		if (steps > stride - 1 - s)
+			steps = stride - 1 - s;
+		fn(ts, s, stride, k, h, out, steps);
+		for (t = 0; t < steps; t++) {
+			for (j = 0; j < lanes; j++) {
+				if (out[t*lanes + j] != hash(&ts[j*stride + s + t + 1], k)) {
+					printf("%s %s differs from hash() (k %d, n %d, lane %d, window %d)\n",
+							RK_ENGINE->name, name, k, n, j, j*stride + s + t + 1);
+					return 0;
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *engines[] = { "m61", "wrap64" };
+	int iterations = 2000;
+	int i, n, k, ok = 1;
+	char *ts;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		srandom(atoi(argv[2]));
+	}
+
+	ts = (char *) malloc(4000 + 204);
+	for (i = 0; i < iterations && ok; i++) {
+		rk_select_engine(engines[i % 2]);
+		k = (random() % 4) ? 4 + random() % 60 : 4 + random() % 200;
+		n = k + random() % 4000;
+		fill_random(ts, n);
+		rehashValue(k);
+		if (rk_lanes(k) == 0 && (rk_has_avx2() || rk_has_avx512())) {
+			printf("%s has no lanes for k %d\n", RK_ENGINE->name, k);
+			ok = 0;
+		}
+		if (ok && rk_has_avx2())
+			ok = check_kernel("avx2", rk_roll_lanes_avx2, 8, ts, n, k);
+		if (ok && rk_has_avx512())
+			ok = check_kernel("avx512", rk_roll_lanes_avx512, 16, ts, n, k);
+		if (ok && rk_lanes(k) > 0)
+			ok = check_kernel("rk_roll_lanes", rk_roll_lanes, rk_lanes(k), ts, n, k);
+	}
+
+	if (!ok) {
+		exit(1);
+	}
+	printf("rkhash: %d documents rolled in lanes identical to hash() (avx2 %s, avx512 %s)\n",
+			iterations, rk_has_avx2() ? "checked" : "unsupported",
+			rk_has_avx512() ? "checked" : "unsupported");
+	return 0;
+}
@@ -0,0 +1,253 @@
+/* Build a k-gram fingerprint index of a directory of documents.
+
+	 ./rkindex [-k snippet_size] [-q prime] [-H engine] [-w window] [-o index] dir
+
+	 Every regular file in dir is normalized as rkmatch does, and the RK
+	 hash of each of its k-character windows is recorded with the
+	 document and the window's offset. The records are written sorted by
+	 hash to the index file (dir.rkx unless -o is given), which
+	 rkmatch -i then probes with the chunk hashes of a query instead of
+	 rehashing the corpus. The -k, -q and -H settings are stored in the
+	 index, and rkmatch -i uses them.
+	 -w <w> records only the winnowed fingerprints of each document (the
+	 minimum of every w consecutive hashes, see winnow.c), which makes the
+	 index about (w+1)/2 times smaller; rkmatch -i then winnows the query
+	 with the same window.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <assert.h>
+
+#include "docload.h"
+#include "rkhash.h"
+#include "fpindex.h"
+#include "winnow.h"
+
+/* the records of all documents, grown as they are hashed */
+typedef struct {
+	fp_record *recs;
+	long long n;
+	long long cap;
+} record_list;
+
+/* Make room for n more records. The room is zeroed, padding included,
+	 as the records are written to the index byte for byte. */
+void
+reserve_records(record_list *l, long long n)
+{
+	long long old_cap = l->cap;
+
+	while (l->n + n > l->cap) {
+		l->cap = l->cap ? 2 * l->cap : 1 << 16;
+		l->recs = (fp_record *) realloc(l->recs, sizeof(fp_record) * l->cap);
+		if (!l->recs) {
+			fprintf(stderr, "failed to allocate %lld records. No memory\n", l->cap);
+			exit(1);
+		}
+	}
+	if (l->cap > old_cap)
+		memset(l->recs + old_cap, 0, sizeof(fp_record) * (l->cap - old_cap));
+}
+
+/* Append the hashes of the doc_len-k+1 windows of document 'doc_id' */
+void
+add_windows(record_list *l, int doc_id, const char *doc, long long doc_len, int k)
+{
+	long long h, hashValue;
+	long long i;
+
+	if (doc_len < k)
+		return;
+	reserve_records(l, doc_len - k + 1);
+	hashValue = rehashValue(k);
+	h = hash(doc, k);
+	for (i = 0; i <= doc_len - k; i++) {
+		l->recs[l->n].hash = h;
+		l->recs[l->n].doc = doc_id;
+		l->recs[l->n].offset = i;
+		l->n++;
+		if (i < doc_len - k)
+			h = rehash(h, hashValue, &doc[i], k);
+	}
+}
+
+/* Append the fingerprints of document 'doc_id' winnowed with window w */
+void
+add_fingerprints(record_list *l, int doc_id, const char *doc, long long doc_len, int k, int w)
+{
+	long long *hashes;
+	long long *offsets;
+	long long i, nfp;
+
+	nfp = winnow_fingerprints(doc, doc_len, k, w, &hashes, &offsets);
+	reserve_records(l, nfp);
+	for (i = 0; i < nfp; i++) {
+		l->recs[l->n].hash = hashes[i];
+		l->recs[l->n].doc = doc_id;
+		l->recs[l->n].offset = offsets[i];
+		l->n++;
+	}
+	free(hashes);
+	free(offsets);
+}
+
+static int
+name_cmp(const void *a, const void *b)
+{
+	return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static int
+has_suffix(const char *name, size_t len, const char *suffix)
+{
+	size_t n = strlen(suffix);
+	return len > n && strcmp(name + len - n, suffix) == 0;
+}
+
+/* The regular files of dir as dir/name, in name order, skipping dot
+	 files, suffix array sidecars (.sa), indexes (.rkx) and the index
+	 being written */
+char **
+list_documents(const char *dir, const char *index_path, int *ndocs)
+{
+	DIR *d;
+	struct dirent *e;
+	struct stat st;
+	char **names = NULL, *path;
+	size_t len;
+	int n = 0, cap = 0;
+
+	d = opendir(dir);
+	if (!d) {
+		perror("opendir ");
+		exit(1);
+	}
+	while ((e = readdir(d)) != NULL) {
+		len = strlen(e->d_name);
+		if (e->d_name[0] == '.' || has_suffix(e->d_name, len, ".sa")
+				|| has_suffix(e->d_name, len, ".rkx"))
+			continue;
+		path = (char *) malloc(strlen(dir) + len + 2);
+		if (!path) {
+			fprintf(stderr, "failed to allocate a document name. No memory\n");
+			exit(1);
+		}
+		sprintf(path, "%s/%s", dir, e->d_name);
+		if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || strcmp(path, index_path) == 0) {
+			free(path);
+			continue;
+		}
+		if (n == cap) {
+			cap = cap ? 2 * cap : 64;
+			names = (char **) realloc(names, sizeof(char *) * cap);
+			if (!names) {
+				fprintf(stderr, "failed to allocate the document list. No memory\n");
+				exit(1);
+			}
+		}
+		names[n++] = path;
+	}
+	closedir(d);
+	if (n > 0)
+		qsort(names, n, sizeof(char *), name_cmp);
+	*ndocs = n;
+	return names;
+}
+
+int
+main(int argc, char **argv)
+{
+	int k = 100;
+	int winnow = 1; /* every window is recorded unless -w is given */
+	char *index_path = NULL, *dir, *doc;
+	char **names;
+	int ndocs, i, c;
+	long long doc_len;
+	size_t len;
+	record_list l = { NULL, 0, 0 };
+
+	assert(sizeof(long long) == 8);
+
+	while ((c = getopt(argc, argv, "k:q:H:w:o:")) != -1) {
+		switch (c)
+		{
+			case 'k':
+				k = atoi(optarg);
+				if (k < 1) {
+					fprintf(stderr, "-k needs a positive snippet size\n");
+					exit(1);
+				}
+				break;
+			case 'q':
+				BIG_PRIME = atoi(optarg);
+				break;
+			case 'H':
+				if (!rk_select_engine(optarg)) {
+					fprintf(stderr, "-H takes one of: %s\n", RK_ENGINE_NAMES);
+					exit(1);
+				}
+				break;
+			case 'w':
+				winnow = atoi(optarg);
+				if (winnow < 1) {
+					fprintf(stderr, "-w needs a positive winnowing window\n");
+					exit(1);
+				}
+				break;
+			case 'o':
+				index_path = optarg;
+				break;
+			default:
+				fprintf(stderr, "Valid options are: -k <snippet size> -q <prime modulus> "
+						"-H <hash engine: %s> -w <winnowing window> -o <index file>\n", RK_ENGINE_NAMES);
+				exit(1);
+		}
+	}
+	if (argc - optind != 1) {
+		printf("Usage: ./rkindex [-k snippet_size] [-q prime] [-H engine] [-w window] [-o index] dir\n");
+		exit(1);
+	}
+	dir = argv[optind];
+	len = strlen(dir);
+	while (len > 1 && dir[len-1] == '/')
+		dir[--len] = 0;
+	if (!index_path) {
+		index_path = (char *) malloc(len + 5);
+		if (!index_path) {
+			fprintf(stderr, "failed to allocate the index name. No memory\n");
+			exit(1);
+		}
+		sprintf(index_path, "%s.rkx", dir);
+	}
+
+	names = list_documents(dir, index_path, &ndocs);
+	for (i = 0; i < ndocs; i++) {
+		load_file(names[i], &doc, &doc_len);
+		if (winnow > 1)
+			add_fingerprints(&l, i, doc, doc_len, k, winnow);
+		else
+			add_windows(&l, i, doc, doc_len, k);
+		free(doc);
+	}
+	if (!fp_index_write(index_path, k, winnow, RK_ENGINE->name, BIG_PRIME, names, ndocs, l.recs, l.n)) {
+		perror("failed to write the index ");
+		exit(1);
+	}
+	if (winnow > 1)
+		printf("%d documents, %lld %d-gram fingerprints (window %d) indexed in %s\n", 
+				ndocs, l.n, k, winnow, index_path);
+	else
+		printf("%d documents, %lld %d-grams indexed in %s\n", ndocs, l.n, k, index_path);
+
+	for (i = 0; i < ndocs; i++)
+		free(names[i]);
+	free(names);
+	free(l.recs);
+	return 0;
+}
@@ -3,6 +3,63 @@
 
 	 ./rkmatch snippet_size query_doc doc1 [doc2...]
 
+	 The query is read, normalized (and for RKBATCH, inserted into the
+	 bloom filter) once. The documents are then handed out to -j <threads>
+	 worker threads, and one result line is printed per document.
+	 With a single document, the RKBATCH scan of that document is split
+	 across the threads instead. The query, and documents when there are
+	 fewer of them than threads, are normalized by several threads too
+	 (see normalize_parallel).
+
+	 Documents are mmap()ed and normalized straight out of the page cache
+	 into a normalized copy, which every algorithm but -l fused then works
+	 on as a whole; -l read falls back to read()ing them into memory first.
+	 -l fused (RKBATCH) never makes a normalized copy of a document: it is
+	 normalized a few KB at a time out of the read-only mapping and each
+	 piece is hashed and looked up while still in cache, one pass in all.
+	 Each document is then scanned by one thread.
+	 -T reports load, time-to-first-hash and match times on stderr.
+	 -b <bytes> makes RKBATCH stream each document in blocks of that size
+	 instead, so only the query and one block need to fit in memory.
+	 -H picks the rolling hash: prime (the default, modulo -q), m61, wrap64 
+	 or buz; see rkhash.c.
+	 -f blocked keeps each query chunk's bloom bits in one cache line;
+	 -f pow2 indexes a power-of-two bitmap of words without any %.
+	 -t 3 finds all chunks in one pass with an Aho-Corasick automaton
+	 (see acmatch.c), counting them the way SIMPLE and RK do.
+	 -t 4 looks every chunk up in a suffix array of the document instead of
+	 scanning it. The index is saved as <doc>.sa and reused by later runs
+	 for as long as the document is unchanged (see sufarr.c).
+	 -t 5 (k <= 64) keeps a Shift-Or state word per chunk and advances all
+	 of them on each byte of the document, several per SIMD instruction
+	 (see shiftor.c).
+	 -t 6 (Horspool) and -t 7 (Two-Way) search for each chunk as SIMPLE does,
+	 but skip ahead through the document using tables built once per chunk
+	 (see skipsearch.c).
+	 -i <index> matches the query against every document of a k-gram index
+	 built by rkindex instead of the documents on the command line:
+	 ./rkmatch -i corpus.rkx query_doc. k and the hash come from the index,
+	 and a chunk counts as found in a document when the index holds a window
+	 of it with the chunk's hash (the text itself is not in the index).
+	 -p <fpr> sizes the RKBATCH bloom filter (bits and number of hashes) 
+	 for that false positive rate instead of 10 bits per query chunk, and
+	 reports the filter's expected rate on stderr (as does -T).
+	 -w <w> winnows RKBATCH: of every w consecutive k-gram hashes, of the
+	 query and of the documents, only the minimum is kept (see winnow.c),
+	 so the filter holds about 2m/(w+1) fingerprints instead of m/k chunks
+	 and a document is looked up at about 2/(w+1) of its windows. The result
+	 is the fraction of the query's fingerprints found in the document.
+	 2m/(w+1) is only fewer than m/k for w >= 2k-1: a smaller window keeps
+	 more fingerprints than there are chunks, and so a bigger filter, in
+	 exchange for catching shared substrings down to w+k-1 bytes instead of
+	 the 2k-1 the chunks need. rkmatch warns when that is the case.
+	 With -i, the window is the one the index was built with (rkindex -w).
+	 -r <doc> turns the command line around for RKBATCH: every document
+	 given is a query, and all of them are matched against doc at once,
+	 ./rkmatch -t 2 -r doc query_doc1 [query_doc2...]. The chunks of all the
+	 queries go into one bloom filter and chunk table, each tagged with its
+	 query, so doc is scanned once instead of once per query. One line is
+	 printed per query, as ./rkmatch -t 2 query_doc doc would print it.
 */
 
 #include <stdio.h>
@@ -11,197 +68,68 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 #include <strings.h>
 #include <assert.h>
+#include <limits.h>
 #include <time.h>
+#include <pthread.h>
 
 #include "bloom.h"
+#include "normalize.h"
+#include "docload.h"
+#include "rkhash.h"
+#include "chunktab.h"
+#include "acmatch.h"
+#include "sufarr.h"
+#include "fpindex.h"
+#include "winnow.h"
+#include "shiftor.h"
+#include "substr.h"
+#include "skipsearch.h"
 
-enum algotype { SIMPLE = 0, RK, RKBATCH};
+enum algotype { SIMPLE = 0, RK, RKBATCH, AHOCORASICK, SUFFIXARRAY, SHIFTOR, HORSPOOL, TWOWAY};
 
-/* a large prime for RK hash (BIG_PRIME*256 does not overflow)*/
-long long BIG_PRIME = 5003943032159437; 
+/* print per-document timings on stderr (-T) */
+int PRINT_TIMING = 0;
 
-/* constants used for printing debug information */
-const int PRINT_RK_HASH = 5;
+/* constants used for printing debug information
+	 (PRINT_RK_HASH is cleared when several documents are matched at once,
+	 since their RK output would interleave) */
+int PRINT_RK_HASH = 5;
 const int PRINT_BLOOM_BITS = 160;
 
-/* modulo addition */
-long long
-madd(long long a, long long b)
-{
-	return ((a+b)>BIG_PRIME?(a+b-BIG_PRIME):(a+b));
-}
-
-/* modulo substraction */
-long long
-mdel(long long a, long long b)
-{
-	return ((a>b)?(a-b):(a+BIG_PRIME-b));
-}
-
-/* modulo multiplication*/
-long long
-mmul(long long a, long long b)
-{
-	return ((a*b) % BIG_PRIME);
-}
-
-/* read the entire content of the file 'fname' into a 
-	 character array allocated by this procedure.
-	 Upon return, *doc contains the address of the character array
-	 *doc_len contains the length of the array
-	 */
-void
-read_file(const char *fname, char **doc, int *doc_len) 
-{
-	struct stat st;
-	int fd;
-	int n = 0;
-
-	fd = open(fname, O_RDONLY);
-	if (fd < 0) {
-		perror("read_file: open ");
-		exit(1);
-	}
-
-	if (fstat(fd, &st) != 0) {
-		perror("read_file: fstat ");
-		exit(1);
-	}
-
-	*doc = (char *)malloc(st.st_size);
-	if (!(*doc)) {
-		fprintf(stderr, " failed to allocate %d bytes. No memory\n", (int)st.st_size);
-		exit(1);
-	}
-
-	n = read(fd, *doc, st.st_size);
-	if (n < 0) {
-		perror("read_file: read ");
-		exit(1);
-	}else if (n != st.st_size) {
-		fprintf(stderr,"read_file: short read!\n");
-		exit(1);
-	}
-	
-	close(fd);
-	*doc_len = n;
-}
-
+/* the substring search and the window compare for the snippet size, 
+	 picked once in main: kernels compiled for k = 16, 32, 50, 64 and 100,
+	 the generic ones for any other k (see substr.c) */
+substr_finder SIMPLE_FIND = substr_find;
+substr_comparer CHUNK_EQUAL = substr_equal;
 
-/* The normalize procedure examines a character array of size len 
-	 in ONE PASS and does the following:
-	 1) turn all upper case letters into lower case ones
-	 2) turn any white-space character into a space character and, 
-	    shrink any n>1 consecutive spaces into exactly 1 space only
-			Hint: use C library function isspace() 
-	 You must do the normalization IN PLACE so that when the procedure
-	 returns, the character array buf contains the normalized string and 
-	 the return value is the length of the normalized string.
-*/
-int
-normalize(char *buf,	/* The character array containing the string to be normalized*/
-					int len			/* the size of the original character array */)
+/* milliseconds on a monotonic clock, for -T timing reports */
+double
+now_ms(void)
 {
-  /* A new buffer must be created in order to remove spaces without massive cost
-     If it is attempted to do the normalization in place the cost is roughly 30 times greater
-     since an additional for loop is required to do the space removal*/
-  int i = 0, j = 0;
-  /* Remove leading Whitespace*/
-  while(buf[i] >= 0 && buf[i] <= 32) i++;
-  while(i < len)
-  {
-      /* If the letter is capitalized,
-             change it's ascii value to the lowercase equivalent */
-      if (buf[i] >= 'A' && buf[i] <= 'Z') 
-      {
-	buf[j++] = buf[i] + 32;
-      }
-      /* Change all weird spaces to space*/
-      else if (buf[i] >= 0 && buf[i] <= 32)
-      {
-	/* only add the space if it is singular*/
-	if((buf[i-1] >= 0 && buf[i-1] <= 32) == 0) buf[j++] = 32;
-      }
-      /*if nothing is weird just insert the value*/
-      else 
-      {
-	buf[j++] = buf[i];
-      }
-      i++;
-  }
-  /* Remove Trailing Whitespace*/
-  while(buf[j-1] >= 0 && buf[j-1] <= 32) j--;
-  buf[j] = NULL;
-  len = j;
-  return len;
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
 }
 
 /* check if a query string ps (of length k) appears 
 	 in ts (of length n) as a substring 
 	 If so, return 1. Else return 0
-	 You may want to use the library function strncmp
+	 substr_find() tests the first and last bytes of many windows at
+	 once (see substr.c) instead of calling strncmp at every offset
 	 */
 int
 simple_match(const char *ps,	/* the query string */
 						 int k, 					/* the length of the query string */
 						 const char *ts,	/* the document string (Y) */ 
-						 int n						/* the length of the document Y */)
+						 long long n			/* the length of the document Y */)
 {
-  int i, j;
   /* If the document string is longer than the query
                    the document cannot contain query*/
   if(n < k) return 0;
-  for(i=0; i <= n - k; i++)
-  {
-    /* Compare the Query to the Possible match(beginning at index i)
-       Both of these strings are length k*/
-    if(strncmp(ps, &ts[i], (size_t) k) == 0)
-    {
-      return 1;
-    }
-  }
-  return 0;
-}
-
-/*Calculate the Initial hash value*/
-long long
-hash(const char *ps, int k)
-{
-  long long hashed = 0;
-  int i;
-  /* hash(P [0...k − 1]) = 
-256^(k-1)∗ P [0] + 256^(k−2)∗P [1] + ... + 256 ∗P [k − 2] + P [k − 1]]*/
-  for(i = 0; i < k; i++)
-  {
-    hashed = mmul(256, hashed);
-    hashed = madd(hashed, (long long) ps[i]);
-  }
-  return hashed;
-}
-
-/*Calculate the Rolling hash value*/
-long long
-rehash(long long previous, long long hashValue, const char *ps, int k)
-{
-  long long rehashed = 0;
-  /* Y_(i+1) = 256 ∗ (y_(i)− 256^(k−1)∗Y [i]) + Y [i + k]*/
-  rehashed = madd(mmul((long long) 256, mdel(previous, mmul(hashValue, (long long) ps[0]))), (long long) ps[k]);
-  return rehashed;
-}
-
-/* Create and return the power of 256 which will be needed for the rolling hash*/
-long long rehashValue(int k)
-{
-  long long h = 1;
-  int i;
-  /*256^(k-1)*/
-  for(i = 1; i < k; i++)
-  {
-    h = mmul(h, (long long) 256);
-  }
-  return h;
+  return SIMPLE_FIND(ps, k, ts, n) >= 0;
 }
 
 /* Check if a query string ps (of length k) appears 
@@ -218,11 +146,11 @@ int
 rabin_karp_match(const char *ps,	/* the query string */
 								 int k, 					/* the length of the query string */
 								 const char *ts,	/* the document string (Y) */ 
-								 int n						/* the length of the document Y */ )
+								 long long n			/* the length of the document Y */ )
 {
   if (n < k) return 0;
   long long query, search, hashValue;
-  int i;
+  long long i;
   hashValue = rehashValue(k);
   /* Initial Hashes*/
   query = hash(ps, k);
@@ -233,90 +161,1113 @@ rabin_karp_match(const char *ps,	/* the query string */
     if(i < PRINT_RK_HASH) printf("%lld ", search);
     /* First checks if the hashes are equal, 
        then confirms that they are indeed a match*/
-    if (search == query && strncmp(ps, &ts[i], k) == 0)
+    if (search == query && CHUNK_EQUAL(ps, &ts[i], k))
     {
-      printf("\n");
+      if (PRINT_RK_HASH) printf("\n");
       return 1;
     }
-    /*Rehash*/
-    search = rehash(search, hashValue, &ts[i], k);
+    /*Rehash (ts[n] is past the end of the document)*/
+    if (i < n - k)
+      search = rehash(search, hashValue, &ts[i], k);
   }
-  printf("\n");
+  if (PRINT_RK_HASH) printf("\n");
   return 0;
 }
 
-/* Initialize the bitmap for the bloom filter using bloom_init().
-	 Insert all m/k RK hashes of qs into the bloom filter using bloom_add().
-	 Then, compute each of the n-k+1 RK hashes of ts and check if it's in the filter using bloom_query().
-	 Use the given procedure, hash_i(i, p), to compute the i-th bloom filter hash value for the RK value p.
+/* What RKBATCH builds once per query: the bloom filter that screens every
+	 window, and the chunk table that narrows a hit down to the chunks whose
+	 RK hash it shares. Both are read-only while documents are scanned. */
+typedef struct {
+	bloom_filter bf;
+	chunk_table chunks;
+	int winnow;   /* -w: window of the winnowed query, 0 for the m/k chunks */
+	int nfp;      /* entries of the chunk table: chunks, or fingerprints */
+	long long *fp_off; /* with -w, the offset in qs of each fingerprint */
+	int nqueries;      /* queries whose chunks are in the table (-r), else 1 */
+	int *query;        /* with -r, the query each entry belongs to */
+} batch_index;
 
-	 Return the number of matched chunks. 
+/* The k bytes of qs that chunk table entry j stands for */
+static const char *
+batch_entry(const batch_index *ix, const char *qs, int k, int j)
+{
+  return ix->fp_off ? &qs[ix->fp_off[j]] : &qs[j*k];
+}
+
+/* Confirm a bloom filter hit on the window w (whose RK hash is h) is not a 
+	 false collision: return 1 if w equals one of the m/k chunks of qs.
+	 Only chunks with the same hash as w can be equal to it.
+	 With several queries (ix->query), add 1 to query_matches[q] for every
+	 query q that has a chunk equal to w. */
+int
+batch_verify(const batch_index *ix, const char *qs, int k, long long h, const char *w,
+             long long *query_matches)
+{
+  int j, last = -1;
+  for(j = chunktab_first(&ix->chunks, h); j >= 0; j = chunktab_next(&ix->chunks, j))
+  {
+    /* entries are chained in descending order, so the chunks of one query
+       with this hash are consecutive: count w once per query */
+    if (ix->query && ix->query[j] == last)
+      continue;
+    if(CHUNK_EQUAL(batch_entry(ix, qs, k, j), w, k))
+    {
+      /*If the match occurs finish the loop to save time*/
+      if (!ix->query)
+        return 1;
+      last = ix->query[j];
+      query_matches[last]++;
+    }
+  }
+  return last >= 0;
+}
+
+/* One thread's share of the RKBATCH scan: windows [start, end) of ts.
+	 Neighbouring ranges overlap by k-1 bytes of ts, so every window is
+	 scanned by exactly one thread.*/
+typedef struct {
+	const batch_index *ix; /* shared, read-only once the query is inserted */
+	int k;
+	const char *qs;
+	const char *ts;
+	long long start;      /* first window scanned */
+	long long end;        /* one past the last window scanned */
+	long long matches;    /* result: number of matched windows in the range */
+	long long bloom_hits; /* result: windows the bloom filter let through */
+	long long *query_matches; /* result with -r: matched windows per query */
+} batch_job;
+
+/* batch_windows() with one rolling hash, the scan of every engine */
+static long long
+batch_windows_scalar(const batch_index *ix, const char *qs, int k, long long hashValue,
+                     const char *ts, long long start, long long end, long long *search, 
+                     long long *bloom_hits, long long *query_matches)
+{
+  long long hashes[BLOOM_BATCH];
+  unsigned char hit[BLOOM_BATCH];
+  long long i, matches = 0;
+  int b, nb;
+
+  for (i = start; i < end; i += nb)
+  {
+    nb = (end - i < BLOOM_BATCH) ? end - i : BLOOM_BATCH;
+    for (b = 0; b < nb; b++)
+    {
+      hashes[b] = *search;
+      /* begin the next search value (the last window of the range has no successor)*/
+      if (i + b + 1 < end)
+        *search = rehash(*search, hashValue, &ts[i+b], k);
+    }
+    bloom_query_batch(ix->bf, hashes, nb, hit);
+    for (b = 0; b < nb; b++)
+    {
+      if (hit[b])
+      {
+        *bloom_hits += 1;
+        if (batch_verify(ix, qs, k, hashes[b], &ts[i+b], query_matches))
+          matches += 1;
+      }
+    }
+  }
+  return matches;
+}
+
+/* Steps rolled per rk_roll_lanes() call, and the shortest stripe worth
+   seeding a lane for (every lane but the first starts with a hash()) */
+#define LANE_STEPS 64
+#define LANE_MIN_STRIPE(k) ((k) < 8 ? 64 : 8 * (k))
+
+/* batch_windows() with rk_roll_lanes(): the windows are cut into 'lanes'
+   stripes of S windows whose hashes are rolled side by side, and checked
+   against the filter BLOOM_BATCH at a time as they come out. The windows
+   past the last full stripe are left to the scalar scan. */
+static long long
+batch_windows_lanes(const batch_index *ix, const char *qs, int k, long long hashValue,
+                    const char *ts, long long start, long long end, long long *search, 
+                    long long *bloom_hits, long long *query_matches, int lanes)
+{
+  long long h[RK_MAX_LANES], hashes[LANE_STEPS * RK_MAX_LANES];
+  unsigned char hit[BLOOM_BATCH];
+  long long S = (end - start) / lanes, s, w, matches = 0;
+  int j, e, b, nb, steps, total;
+
+  h[0] = *search;
+  for (j = 1; j < lanes; j++)
+    h[j] = hash(&ts[start + j*S], k);
+  for (s = 0; s < S; s += steps)
+  {
+    /* hashes[t*lanes + j] is the hash of window start + j*S + s + t */
+    if (s == 0) {
+      memcpy(hashes, h, sizeof(long long) * lanes);
+      steps = 1 + ((S - 1 < LANE_STEPS - 1) ? S - 1 : LANE_STEPS - 1);
+      rk_roll_lanes(ts, start, S, k, h, &hashes[lanes], steps - 1);
+    } else {
+      steps = (S - s < LANE_STEPS) ? S - s : LANE_STEPS;
+      rk_roll_lanes(ts, start + s - 1, S, k, h, hashes, steps);
+    }
+    total = steps * lanes;
+    for (e = 0; e < total; e += nb)
+    {
+      nb = (total - e < BLOOM_BATCH) ? total - e : BLOOM_BATCH;
+      bloom_query_batch(ix->bf, &hashes[e], nb, hit);
+      for (b = 0; b < nb; b++)
+      {
+        if (hit[b])
+        {
+          *bloom_hits += 1;
+          w = start + ((e + b) % lanes) * S + s + (e + b) / lanes;
+          if (batch_verify(ix, qs, k, hashes[e+b], &ts[w], query_matches))
+            matches += 1;
+        }
+      }
+    }
+  }
+  /* the last lane ended on window start + lanes*S - 1 */
+  *search = h[lanes-1];
+  if (start + lanes * S < end) {
+    *search = rehash(*search, hashValue, &ts[start + lanes*S - 1], k);
+    matches += batch_windows_scalar(ix, qs, k, hashValue, ts, start + lanes*S, end,
+                                    search, bloom_hits, query_matches);
+  }
+  return matches;
+}
+
+/* Check windows [start, end) of ts against the index. The rolling hashes
+	 are collected BLOOM_BATCH at a time and handed to bloom_query_batch(),
+	 which prefetches all of their bitmap lines before testing any. Long
+	 ranges are hashed in SIMD lanes when the engine allows (rk_lanes()).
+	 On entry *search is the hash of window start; on return it is the hash 
+	 of window end-1. Return the number of matched windows and add the 
+	 windows that passed the filter to *bloom_hits (and with several 
+	 queries, each query's matched windows to query_matches). */
+long long
+batch_windows(const batch_index *ix, const char *qs, int k, long long hashValue,
+              const char *ts, long long start, long long end, long long *search, 
+              long long *bloom_hits, long long *query_matches)
+{
+  int lanes = rk_lanes(k);
+
+  if (lanes > 0 && (end - start) / lanes >= LANE_MIN_STRIPE(k))
+    return batch_windows_lanes(ix, qs, k, hashValue, ts, start, end, search, 
+                               bloom_hits, query_matches, lanes);
+  return batch_windows_scalar(ix, qs, k, hashValue, ts, start, end, search, 
+                              bloom_hits, query_matches);
+}
+
+/* Scan the windows of job->ts assigned to this job, seeding the rolling hash
+	 at job->start with hash() */
+void *
+batch_scan(void *arg)
+{
+  batch_job *job = (batch_job *) arg;
+  long long search;
+
+  job->bloom_hits = 0;
+  search = hash(&job->ts[job->start], job->k);
+  job->matches = batch_windows(job->ix, job->qs, job->k, rehashValue(job->k),
+                               job->ts, job->start, job->end, &search, &job->bloom_hits,
+                               job->query_matches);
+  return NULL;
+}
+
+/* Initialize the bitmap for the bloom filter using bloom_init(), or
+	 bloom_init_fpr() when a target false positive rate fpr > 0 is given.
+	 Insert all m/k RK hashes of qs into the bloom filter using bloom_add(),
+	 and into the chunk table used to verify the filter's hits.
+	 With winnow > 0 the winnowed fingerprints of qs (see winnow.c) are
+	 inserted instead of the chunks, and bsz is scaled down to the
+	 same 10 bits for each of them.
 	 Additionally, print out the first PRINT_BLOOM_BITS of the bloom filter using the given bloom_print 
 	 after inserting m/k substrings from qs.
+	 The index is built once per query and shared by every document.
 */
-int
-rabin_karp_batchmatch(int bsz,        /* size of bitmap (in bits) to be used */
+batch_index
+rabin_karp_batchbuild(long long bsz,  /* size of bitmap (in bits) to be used */
                       int k,          /* chunk length to be matched */
                       const char *qs, /* query docoument (X)*/
-                      int m,          /* query document length */ 
-                      const char *ts, /* to-be-matched document (Y) */
-                      int n           /* to-be-matched document length*/)
+                      long long m,    /* query document length */
+                      int bloom_kind, /* bloom filter layout, see bloom.h */
+                      double fpr,     /* if > 0, size the filter for this rate instead */
+                      int winnow      /* if > 0, insert the fingerprints of this window */)
 {
-  bloom_filter bf;
-  int i, j, matches = 0;
-  long long hashValue, search;
-  if (n < k) return 0;
+  batch_index ix;
+  long long h, *fps = NULL;
+  int i;
+
+  ix.winnow = winnow;
+  ix.fp_off = NULL;
+  ix.nqueries = 1;
+  ix.query = NULL;
+  ix.nfp = (int) (m / k);
+  if (winnow > 0) {
+    ix.nfp = (int) winnow_fingerprints(qs, m, k, winnow, &fps, &ix.fp_off);
+    bsz = (((long long) ix.nfp*10)>>3)<<3;
+    if (bsz < 8) bsz = 8;
+  }
   /* initialize the bitmap*/
-  bf = bloom_init(bsz);
-  hashValue = rehashValue(k);
-  /* insert m/k substrings */
-  for (i=0; i < m / k; i++)
+  if (fpr > 0)
+    ix.bf = bloom_init_fpr_kind(ix.nfp, fpr, bloom_kind);
+  else
+    ix.bf = bloom_init_kind(bsz, bloom_kind);
+  ix.chunks = chunktab_init(ix.nfp);
+  /* insert m/k substrings (or the fingerprints) */
+  for (i=0; i < ix.nfp; i++)
   {
-    bloom_add(bf, hash(&qs[i*k], k));
+    h = fps ? fps[i] : hash(&qs[i*k], k);
+    bloom_add(ix.bf, h);
+    chunktab_add(&ix.chunks, h, i);
   }
+  free(fps);
   /* Print the requested # of values*/
-  bloom_print(bf, PRINT_BLOOM_BITS);
-  /* Perform the initial search*/
-  search = hash(ts, k);
-  for (i=0; i <= n - k; i++)
+  bloom_print(ix.bf, PRINT_BLOOM_BITS);
+  return ix;
+}
+
+void
+rabin_karp_batchfree(batch_index *ix)
+{
+  bloom_free(&ix->bf);
+  chunktab_free(&ix->chunks);
+  free(ix->fp_off);
+  free(ix->query);
+}
+
+/* rabin_karp_batchbuild() for several queries at once (-r): qs holds the
+	 nqueries normalized queries one after the other, query q being the 
+	 qlen[q] bytes at qoff[q]. The m/k chunks of every query go into one
+	 filter and one chunk table, each entry tagged with its query. The
+	 filter has the same 10 bits per chunk (or fpr) as for one query. */
+batch_index
+rabin_karp_multibuild(int k,          /* chunk length to be matched */
+                      const char *qs, /* the queries, concatenated */
+                      int nqueries,
+                      const long long *qoff, /* offset of each query in qs */
+                      const long long *qlen, /* length of each query */
+                      int bloom_kind, /* bloom filter layout, see bloom.h */
+                      double fpr      /* if > 0, size the filter for this rate instead */)
+{
+  batch_index ix;
+  long long h, bsz;
+  int q, i, j;
+
+  ix.winnow = 0;
+  ix.nqueries = nqueries;
+  ix.nfp = 0;
+  for (q = 0; q < nqueries; q++)
+    ix.nfp += (int) (qlen[q] / k);
+  ix.fp_off = (long long *) malloc(sizeof(long long) * (ix.nfp > 0 ? ix.nfp : 1));
+  ix.query = (int *) malloc(sizeof(int) * (ix.nfp > 0 ? ix.nfp : 1));
+  if (!ix.fp_off || !ix.query) {
+    fprintf(stderr, "rabin_karp_multibuild: failed to allocate %d chunks. No memory\n", ix.nfp);
+    exit(1);
+  }
+  bsz = (((long long) ix.nfp*10)>>3)<<3;
+  if (bsz < 8) bsz = 8;
+  if (fpr > 0)
+    ix.bf = bloom_init_fpr_kind(ix.nfp, fpr, bloom_kind);
+  else
+    ix.bf = bloom_init_kind(bsz, bloom_kind);
+  ix.chunks = chunktab_init(ix.nfp);
+  /* entries are numbered query by query, see batch_verify() */
+  j = 0;
+  for (q = 0; q < nqueries; q++)
   {
-    if (bloom_query(bf, search))
+    for (i = 0; i < qlen[q] / k; i++, j++)
     {
-      /* Confirm it is not a false collision*/
-      for(j=0; j < m / k; j++)
-      {
-	if(strncmp(&qs[j*k], &ts[i], (size_t) k) == 0)
-	{
-	  matches += 1;
-	  /*If the match occurs finish the loop to save time*/
-	  break;
-	}
+      ix.fp_off[j] = qoff[q] + (long long) i*k;
+      ix.query[j] = q;
+      h = hash(&qs[ix.fp_off[j]], k);
+      bloom_add(ix.bf, h);
+      chunktab_add(&ix.chunks, h, j);
+    }
+  }
+  bloom_print(ix.bf, PRINT_BLOOM_BITS);
+  return ix;
+}
+
+/* Compute each of the n-k+1 RK hashes of ts and check if it's in the filter
+	 built by rabin_karp_batchbuild() using bloom_query().
+	 Use the given procedure, hash_i(i, p), to compute the i-th bloom filter hash value for the RK value p.
+	 Each hit is verified against the chunks the chunk table lists for its hash.
+
+	 Return the number of matched chunks, and in *bloom_hits the number of
+	 windows that passed the filter and had to be verified.
+
+	 The n-k+1 windows of ts are split into nthreads contiguous ranges which
+	 are scanned in parallel against the same bloom filter.
+	 With several queries in ix (-r), query_matches[q] is set to the number
+	 of windows matching a chunk of query q.
+*/
+long long
+rabin_karp_batchmatch(const batch_index *ix, /* index over the m/k chunks of qs */
+                      int k,          /* chunk length to be matched */
+                      const char *qs, /* query docoument (X)*/
+                      const char *ts, /* to-be-matched document (Y) */
+                      long long n,    /* to-be-matched document length*/
+                      int nthreads,   /* number of threads scanning ts */
+                      long long *bloom_hits, /* out: windows verified against qs */
+                      long long *query_matches /* out with -r: windows per query */)
+{
+  batch_job *jobs;
+  pthread_t *tids;
+  long long per_thread, matches = 0;
+  int i, q;
+  *bloom_hits = 0;
+  if (query_matches)
+    memset(query_matches, 0, sizeof(long long) * ix->nqueries);
+  if (n < k) return 0;
+
+  /* never hand a thread an empty range*/
+  if (nthreads < 1) nthreads = 1;
+  if (nthreads > n - k + 1) nthreads = n - k + 1;
+  per_thread = (n - k + 1 + nthreads - 1) / nthreads;
+
+  jobs = (batch_job *) malloc(sizeof(batch_job) * nthreads);
+  tids = (pthread_t *) malloc(sizeof(pthread_t) * nthreads);
+  if (!jobs || !tids) {
+    fprintf(stderr, "rabin_karp_batchmatch: failed to allocate %d jobs\n", nthreads);
+    exit(1);
+  }
+  for (i = 0; i < nthreads; i++)
+  {
+    jobs[i].ix = ix;
+    jobs[i].k = k;
+    jobs[i].qs = qs;
+    jobs[i].ts = ts;
+    jobs[i].start = i * per_thread;
+    jobs[i].end = (i + 1) * per_thread;
+    if (jobs[i].end > n - k + 1) jobs[i].end = n - k + 1;
+    jobs[i].matches = 0;
+    jobs[i].bloom_hits = 0;
+    jobs[i].query_matches = NULL;
+    if (query_matches) {
+      jobs[i].query_matches = (long long *) calloc(ix->nqueries, sizeof(long long));
+      if (!jobs[i].query_matches) {
+        fprintf(stderr, "rabin_karp_batchmatch: failed to allocate %d counts\n", ix->nqueries);
+        exit(1);
+      }
+    }
+  }
+
+  if (nthreads == 1) {
+    batch_scan(&jobs[0]);
+  } else {
+    for (i = 0; i < nthreads; i++) {
+      if (pthread_create(&tids[i], NULL, batch_scan, &jobs[i]) != 0) {
+        perror("rabin_karp_batchmatch: pthread_create ");
+        exit(1);
       }
     }
-    /* begin the next search value*/
-    search = rehash(search, hashValue, &ts[i], k);
-  } 
+    for (i = 0; i < nthreads; i++) {
+      pthread_join(tids[i], NULL);
+    }
+  }
+
+  for (i = 0; i < nthreads; i++)
+  {
+    matches += jobs[i].matches;
+    *bloom_hits += jobs[i].bloom_hits;
+    if (query_matches) {
+      for (q = 0; q < ix->nqueries; q++)
+        query_matches[q] += jobs[i].query_matches[q];
+      free(jobs[i].query_matches);
+    }
+  }
+  free(jobs);
+  free(tids);
+  return matches;
+}
+
+/* Look the fingerprints hashes[0..nb) of ts (at offsets offs) up in the
+	 filter, and mark every query fingerprint that one of them equals. */
+static void
+winnow_lookup(const batch_index *ix, const char *qs, int k, const char *ts,
+              const long long *hashes, const long long *offs, int nb, 
+              unsigned char *found, long long *bloom_hits)
+{
+  unsigned char hit[BLOOM_BATCH];
+  int b, j;
+
+  bloom_query_batch(ix->bf, hashes, nb, hit);
+  for (b = 0; b < nb; b++)
+  {
+    if (!hit[b])
+      continue;
+    *bloom_hits += 1;
+    for (j = chunktab_first(&ix->chunks, hashes[b]); j >= 0; j = chunktab_next(&ix->chunks, j))
+    {
+      if (CHUNK_EQUAL(batch_entry(ix, qs, k, j), &ts[offs[b]], k))
+        found[j] = 1;
+    }
+  }
+}
+
+/* RKBATCH on winnowed fingerprints (-w): winnow the n-k+1 RK hashes of ts
+	 with the same window as the query, and look only the selected ones up,
+	 BLOOM_BATCH at a time. Return the number of distinct query fingerprints
+	 found in ts (out of ix->nfp), and in *bloom_hits the number of 
+	 fingerprints of ts that passed the filter. */
+int
+winnow_match(const batch_index *ix, /* built with winnow > 0 */
+             int k,          /* chunk length to be matched */
+             const char *qs, /* query docoument (X)*/
+             const char *ts, /* to-be-matched document (Y) */
+             long long n,    /* to-be-matched document length*/
+             long long *bloom_hits /* out: fingerprints verified against qs */)
+{
+  winnow_state st;
+  long long hashes[BLOOM_BATCH], search, hashValue, min = 0;
+  long long offs[BLOOM_BATCH], i, min_pos = -1;
+  unsigned char *found;
+  int nb = 0, matches = 0;
+
+  *bloom_hits = 0;
+  if (n < k) return 0;
+  found = (unsigned char *) calloc(ix->nfp > 0 ? ix->nfp : 1, 1);
+  if (!found) {
+    fprintf(stderr, "winnow_match: failed to allocate %d flags. No memory\n", ix->nfp);
+    exit(1);
+  }
+  winnow_init(&st, ix->winnow);
+  hashValue = rehashValue(k);
+  search = hash(ts, k);
+  for (i = 0; i <= n - k; i++)
+  {
+    if (min_pos < 0 || (unsigned long long) search <= (unsigned long long) min) {
+      min = search;
+      min_pos = i;
+    }
+    if (winnow_push(&st, search, i, &hashes[nb], &offs[nb]) && ++nb == BLOOM_BATCH) {
+      winnow_lookup(ix, qs, k, ts, hashes, offs, nb, found, bloom_hits);
+      nb = 0;
+    }
+    if (i < n - k)
+      search = rehash(search, hashValue, &ts[i], k);
+  }
+  /* a document shorter than w+k-1 is fingerprinted by its minimum, 
+     as winnow_fingerprints() does for the query */
+  if (st.last < 0) {
+    hashes[nb] = min;
+    offs[nb] = min_pos;
+    nb++;
+  }
+  winnow_lookup(ix, qs, k, ts, hashes, offs, nb, found, bloom_hits);
+  winnow_free(&st);
+
+  for (i = 0; i < ix->nfp; i++)
+    matches += found[i];
+  free(found);
+  return matches;
+}
+
+/* What the block-wise RKBATCH scans carry from one block to the next:
+	 buf holds the carried window followed by the newly normalized bytes */
+typedef struct {
+	char *buf;
+	int have;         /* bytes in buf */
+	int pos;          /* first window of buf not scanned yet */
+	int hashed;       /* search holds the hash of window pos-1 */
+	long long search;
+} block_scan;
+
+/* Scan every window of bs->buf that now fits, continuing the rolling hash 
+	 from the last window of the previous block, and carry the last scanned 
+	 window (its first byte is the next one rolled out) to the front of buf.
+	 Return the number of matched windows and add the windows that passed 
+	 the filter to *bloom_hits. */
+long long
+block_windows(const batch_index *ix, const char *qs, int k, long long hashValue,
+              block_scan *bs, long long *bloom_hits)
+{
+  long long matches;
+
+  if (bs->pos + k > bs->have)
+    return 0;
+  if (!bs->hashed) {
+    bs->search = hash(&bs->buf[bs->pos], k);
+    bs->hashed = 1;
+  } else {
+    bs->search = rehash(bs->search, hashValue, &bs->buf[bs->pos-1], k);
+  }
+  matches = batch_windows(ix, qs, k, hashValue, bs->buf, bs->pos, bs->have - k + 1, 
+                          &bs->search, bloom_hits, NULL);
+  bs->pos = bs->have - k + 1;
+  memmove(bs->buf, &bs->buf[bs->pos-1], bs->have - (bs->pos-1));
+  bs->have -= bs->pos - 1;
+  bs->pos = 1;
+  return matches;
+}
+
+/* RKBATCH without holding the document in memory: read 'fname' in blocks 
+	 of block_sz bytes, normalize each block with normalize_block() and keep
+	 rolling the hash from one block into the next. Only the last window 
+	 of a block (its k bytes) is carried over, so memory use is 
+	 O(block_sz + k) regardless of the document size.
+	 Return the number of matched chunks, the normalized document length 
+	 in *doc_len and the number of windows verified in *bloom_hits.
+	 */
+long long
+rabin_karp_streammatch(const batch_index *ix, /* index over the m/k chunks of qs */
+                       int k,          /* chunk length to be matched */
+                       const char *qs, /* query docoument (X)*/
+                       const char *fname, /* to-be-matched document (Y) */
+                       int block_sz,   /* bytes read per block */
+                       long long *doc_len, /* out: normalized length of Y */
+                       long long *bloom_hits /* out: windows verified against qs */)
+{
+  norm_state st = { 0, 0 };
+  block_scan bs = { NULL, 0, 0, 0, 0 };
+  char *raw;
+  int fd, n;
+  long long matches = 0;
+  long long hashValue;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    perror("rabin_karp_streammatch: open ");
+    exit(1);
+  }
+  raw = (char *) malloc(block_sz);
+  bs.buf = (char *) malloc(k + block_sz + 1);
+  if (!raw || !bs.buf) {
+    fprintf(stderr, " failed to allocate %d byte blocks. No memory\n", block_sz);
+    exit(1);
+  }
+  *doc_len = 0;
+  *bloom_hits = 0;
+  hashValue = rehashValue(k);
+
+  while ((n = read(fd, raw, block_sz)) > 0)
+  {
+    n = normalize_block(&st, &bs.buf[bs.have], raw, n);
+    bs.have += n;
+    *doc_len += n;
+    matches += block_windows(ix, qs, k, hashValue, &bs, bloom_hits);
+  }
+  if (n < 0) {
+    perror("rabin_karp_streammatch: read ");
+    exit(1);
+  }
+
+  close(fd);
+  free(raw);
+  free(bs.buf);
+  return matches;
+}
+
+/* bytes of the mapping rabin_karp_fusedmatch() normalizes at a time:
+	 small enough for the normalized block to still be in L1 when it is hashed */
+#define FUSED_BLOCK 8192
+
+/* RKBATCH straight out of a read-only mapping of 'fname', in one pass:
+	 FUSED_BLOCK bytes at a time are normalized from the page cache into
+	 a small buffer and hashed and looked up from there while they are
+	 still in L1, as rabin_karp_streammatch() does with the blocks it 
+	 reads. No normalized copy of the document is made and each of its
+	 bytes is loaded from memory once.
+	 Return the number of matched chunks, the normalized document length 
+	 in *doc_len and the number of windows verified in *bloom_hits.
+	 */
+long long
+rabin_karp_fusedmatch(const batch_index *ix, /* index over the m/k chunks of qs */
+                      int k,          /* chunk length to be matched */
+                      const char *qs, /* query docoument (X)*/
+                      const char *fname, /* to-be-matched document (Y) */
+                      long long *doc_len, /* out: normalized length of Y */
+                      long long *bloom_hits /* out: windows verified against qs */)
+{
+  struct stat st;
+  norm_state ns = { 0, 0 };
+  block_scan bs = { NULL, 0, 0, 0, 0 };
+  char *map = NULL;
+  long long i, n, hashValue, matches = 0;
+  int fd;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0) {
+    perror("rabin_karp_fusedmatch: open ");
+    exit(1);
+  }
+  if (fstat(fd, &st) != 0) {
+    perror("rabin_karp_fusedmatch: fstat ");
+    exit(1);
+  }
+  /* mmap refuses empty mappings */
+  if (st.st_size > 0) {
+    map = (char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+      perror("rabin_karp_fusedmatch: mmap ");
+      exit(1);
+    }
+    /* only advisory, ignore failures */
+    madvise(map, st.st_size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+  bs.buf = (char *) malloc(k + FUSED_BLOCK + 1);
+  if (!bs.buf) {
+    fprintf(stderr, " failed to allocate %d byte blocks. No memory\n", FUSED_BLOCK);
+    exit(1);
+  }
+  *doc_len = 0;
+  *bloom_hits = 0;
+  hashValue = rehashValue(k);
+
+  for (i = 0; i < st.st_size; i += FUSED_BLOCK)
+  {
+    n = (st.st_size - i < FUSED_BLOCK) ? st.st_size - i : FUSED_BLOCK;
+    n = normalize_block(&ns, &bs.buf[bs.have], &map[i], n);
+    bs.have += n;
+    *doc_len += n;
+    matches += block_windows(ix, qs, k, hashValue, &bs, bloom_hits);
+  }
+
+  if (map)
+    munmap(map, st.st_size);
+  free(bs.buf);
   return matches;
 }
 
+/* Get the suffix array index of document 'fname': map its sidecar
+	 fname.sa if it is up to date, else load the document, build the index
+	 and save the sidecar for the next run. Return 1 if the sidecar was used. */
+int
+suffix_array_open(const char *fname, sa_index *ix)
+{
+	struct stat st;
+	char *path, *doc;
+	long long doc_len;
+	int loaded;
+
+	if (stat(fname, &st) != 0) {
+		perror("suffix_array_open: stat ");
+		exit(1);
+	}
+	path = (char *) malloc(strlen(fname) + 4);
+	if (!path) {
+		fprintf(stderr, "failed to allocate the index path. No memory\n");
+		exit(1);
+	}
+	sprintf(path, "%s.sa", fname);
+	loaded = sa_index_load(path, &st, ix);
+	if (!loaded) {
+		load_file(fname, &doc, &doc_len);
+		sa_index_build(doc, doc_len, ix);
+		/* the index still works from memory if it cannot be saved */
+		if (!sa_index_save(ix, path, &st))
+			fprintf(stderr, "%s: could not save the suffix array index\n", path);
+	}
+	free(path);
+	return loaded;
+}
+
+/* Look each of the m/k chunks of qs up in the suffix array index of a
+	 document. Return the number of chunks found (as SIMPLE does). If 
+	 occurrences is not NULL (-T), also count how many times they occur in 
+	 total, which takes a second binary search per chunk found. */
+int
+suffix_array_match(const sa_index *ix, int k, const char *qs, long long m, long long *occurrences)
+{
+	long long i;
+	int first, num_matched = 0;
+
+	if (occurrences)
+		*occurrences = 0;
+	for (i = 0; (i+k) <= m; i += k) {
+		first = sa_index_find(ix, &qs[i], k);
+		if (first >= 0) {
+			num_matched++;
+			if (occurrences)
+				*occurrences += sa_index_count(ix, &qs[i], k, first);
+		}
+	}
+	return num_matched;
+}
+
+/* The documents still to be matched against one query. Worker threads
+	 claim the next document under the lock and store its result in place,
+	 so results can be printed in command line order afterwards.*/
+typedef struct {
+	char **fnames;        /* the documents doc1, doc2, ... */
+	long long *num_matched; /* result for each document */
+	int ndocs;
+	int next;             /* index of the next unclaimed document */
+	pthread_mutex_t lock;
+
+	int which_algo;
+	int k;
+	const char *qdoc;     /* the normalized query */
+	long long qdoc_len;
+	batch_index ix;       /* RKBATCH index over qdoc, shared read-only */
+	ac_automaton ac;      /* AHOCORASICK automaton over qdoc, shared read-only */
+	so_matcher so;        /* SHIFTOR masks over qdoc, shared read-only */
+	hp_index hp;          /* HORSPOOL shift tables of the chunks, shared read-only */
+	tw_index tw;          /* TWOWAY factorizations of the chunks, shared read-only */
+	int scan_threads;     /* threads splitting a single RKBATCH scan */
+	int block_sz;         /* if > 0, stream documents in blocks of this size */
+} match_queue;
+
+/* Match the query of q against one normalized document 
+	 using the selected algorithm. Return the number of matched chunks. 
+	 For RKBATCH, *bloom_hits counts the windows that needed verifying. */
+long long
+match_document(match_queue *q, const char *doc, long long doc_len, long long *bloom_hits)
+{
+	long long i;
+	long long num_matched = 0;
+	int k = q->k;
+
+	*bloom_hits = 0;
+
+	switch (q->which_algo) 
+		{
+			case SIMPLE:
+				/* for each of the qdoc_len/k chunks of qdoc, 
+					 check if it appears in doc as a substring*/
+				for (i = 0; (i+k) <= q->qdoc_len; i += k) {
+					if (simple_match(q->qdoc+i, k, doc, doc_len)) {
+						num_matched++;
+					}
+				}
+				break;
+			case RK:
+				/* for each of the qdoc_len/k chunks of qdoc, 
+					 check if it appears in doc as a substring using 
+				   the rabin-karp substring matching algorithm */
+				for (i = 0; (i+k) <= q->qdoc_len; i += k) {
+					if (rabin_karp_match(q->qdoc+i, k, doc, doc_len)) {
+						num_matched++;
+					}
+				}
+				break;
+			case RKBATCH:
+				/* match all qdoc_len/k chunks simultaneously (in batch) by using a bloom filter*/
+				if (q->ix.winnow > 0) {
+					num_matched = winnow_match(&q->ix, k, q->qdoc, doc, doc_len, bloom_hits);
+					break;
+				}
+				num_matched = rabin_karp_batchmatch(&q->ix, k, q->qdoc, doc, doc_len,
+						q->scan_threads, bloom_hits, NULL);
+				break;
+			case AHOCORASICK:
+				/* find all qdoc_len/k chunks in a single pass over doc */
+				num_matched = ac_match(&q->ac, doc, doc_len);
+				break;
+			case SHIFTOR:
+				/* step one Shift-Or state per chunk over doc, all in lockstep */
+				num_matched = so_match(&q->so, doc, doc_len);
+				break;
+			case HORSPOOL:
+				/* search for each chunk, skipping by its shift table */
+				for (i = 0; (i+k) <= q->qdoc_len; i += k) {
+					if (hp_find(&q->hp, i / k, q->qdoc+i, doc, doc_len) >= 0) {
+						num_matched++;
+					}
+				}
+				break;
+			case TWOWAY:
+				/* search for each chunk with its critical factorization */
+				for (i = 0; (i+k) <= q->qdoc_len; i += k) {
+					if (tw_find(&q->tw, i / k, q->qdoc+i, doc, doc_len) >= 0) {
+						num_matched++;
+					}
+				}
+				break;
+		}
+	return num_matched;
+}
+
+/* Time one pass of the rolling hash alone over the n-k+1 windows of ts,
+	 for the -T report */
+double
+hash_pass_ms(const char *ts, long long n, int k)
+{
+	volatile long long sink;
+	long long hashValue, search;
+	double t;
+	long long i;
+
+	if (n < k) return 0;
+	t = now_ms();
+	hashValue = rehashValue(k);
+	search = hash(ts, k);
+	for (i = 0; i < n - k; i++) {
+		search = rehash(search, hashValue, &ts[i], k);
+	}
+	sink = search;
+	(void) sink;
+	return now_ms() - t;
+}
+
+/* The same pass with the hashes rolled in rk_lanes(k) SIMD lanes, or -1
+	 if the engine has no lane kernel */
+double
+lane_pass_ms(const char *ts, long long n, int k)
+{
+	volatile long long sink;
+	long long h[RK_MAX_LANES], hashes[LANE_STEPS * RK_MAX_LANES];
+	long long S, s;
+	double t;
+	int j, lanes, steps;
+
+	rehashValue(k);
+	lanes = rk_lanes(k);
+	if (lanes == 0) return -1;
+	if (n < k) return 0;
+	t = now_ms();
+	S = (n - k + 1) / lanes;
+	for (j = 0; j < lanes && S > 1; j++)
+		h[j] = hash(&ts[j*S], k);
+	for (s = 0; s + 1 < S; s += steps) {
+		steps = (S - 1 - s < LANE_STEPS) ? S - 1 - s : LANE_STEPS;
+		rk_roll_lanes(ts, s, S, k, h, hashes, steps);
+	}
+	sink = h[0];
+	(void) sink;
+	return now_ms() - t;
+}
+
+/* Worker thread: read, normalize and match documents until the queue is empty*/
+void *
+match_worker(void *arg)
+{
+	match_queue *q = (match_queue *) arg;
+	char *doc;
+	long long doc_len, hits;
+	int d, loaded;
+	long long occurrences;
+	sa_index sx;
+	double t_start, t_loaded, t_hashed, t_matched, t_hash_pass, t_lane_pass;
+
+	for (;;) {
+		pthread_mutex_lock(&q->lock);
+		d = q->next++;
+		pthread_mutex_unlock(&q->lock);
+		if (d >= q->ndocs) 
+			break;
+
+		t_start = now_ms();
+		if (q->block_sz > 0) {
+			/* RKBATCH only: the document is never resident as a whole */
+			q->num_matched[d] = rabin_karp_streammatch(&q->ix, q->k, q->qdoc, q->fnames[d],
+					q->block_sz, &doc_len, &hits);
+			if (PRINT_TIMING)
+				fprintf(stderr, "%s: %lld bytes normalized, streamed in %d byte blocks, match %.3f ms, "
+						"%lld bloom hits, %lld matched\n",
+						q->fnames[d], doc_len, q->block_sz, now_ms() - t_start, hits, q->num_matched[d]);
+			continue;
+		}
+		if (LOADER == LOAD_FUSED) {
+			/* RKBATCH only: normalized and hashed in one pass over the mapping */
+			q->num_matched[d] = rabin_karp_fusedmatch(&q->ix, q->k, q->qdoc,
+					q->fnames[d], &doc_len, &hits);
+			if (PRINT_TIMING)
+				fprintf(stderr, "%s: %lld bytes normalized, normalized and matched in one pass, "
+						"match %.3f ms, %lld bloom hits, %lld matched\n",
+						q->fnames[d], doc_len, now_ms() - t_start, hits, q->num_matched[d]);
+			continue;
+		}
+		if (q->which_algo == SUFFIXARRAY) {
+			/* the document is only read when its index has to be built */
+			loaded = suffix_array_open(q->fnames[d], &sx);
+			t_loaded = now_ms();
+			q->num_matched[d] = suffix_array_match(&sx, q->k, q->qdoc, q->qdoc_len, 
+					PRINT_TIMING ? &occurrences : NULL);
+			if (PRINT_TIMING)
+				fprintf(stderr, "%s: %d bytes normalized, index %s in %.3f ms, match %.3f ms, "
+						"%lld occurrences, %lld matched\n",
+						q->fnames[d], sx.n, loaded ? "loaded" : "built", t_loaded - t_start,
+						now_ms() - t_loaded, occurrences, q->num_matched[d]);
+			sa_index_free(&sx);
+			continue;
+		}
+		load_file(q->fnames[d], &doc, &doc_len);
+		t_loaded = t_hashed = now_ms();
+		if (PRINT_TIMING && doc_len >= q->k) {
+			/* time-to-first-hash: the first window the matchers can look at */
+			volatile long long first = hash(doc, q->k);
+			(void) first;
+			t_hashed = now_ms();
+		}
+		q->num_matched[d] = match_document(q, doc, doc_len, &hits);
+		t_matched = now_ms();
+		if (PRINT_TIMING) {
+			t_hash_pass = hash_pass_ms(doc, doc_len, q->k);
+			t_lane_pass = lane_pass_ms(doc, doc_len, q->k);
+			fprintf(stderr, "%s: %lld bytes normalized, load %.3f ms, first hash %.3f ms, match %.3f ms, "
+					"hash pass %.3f ms, ",
+					q->fnames[d], doc_len, t_loaded - t_start, t_hashed - t_start, t_matched - t_hashed,
+					t_hash_pass);
+			if (t_lane_pass >= 0)
+				fprintf(stderr, "lane hash pass %.3f ms (%d lanes), ", t_lane_pass, rk_lanes(q->k));
+			fprintf(stderr, "%lld windows, %lld bloom hits, %lld matched\n",
+					doc_len >= q->k ? doc_len - q->k + 1 : 0, hits, q->num_matched[d]);
+		}
+		free(doc);
+	}
+	return NULL;
+}
+
+/* Look the chunks of the query qs (of length m) up in the k-gram index
+	 at index_path and print, for every document in it, how many of the
+	 chunks it contains. The chunks are hashed with the index's k and hash
+	 engine. Return the exit status. */
+int
+index_match(const char *index_path, const char *qs, long long m)
+{
+	fp_index fx;
+	int *num_matched;
+	int d, k, probes = 0;
+	long long i, to_be_matched, h, r, records = 0, *fps = NULL;
+	long long *fp_off = NULL;
+	double t_start = now_ms(), t_opened;
+
+	if (!fp_index_open(index_path, &fx))
+		return 1;
+	if (!rk_select_engine(fx.engine)) {
+		fprintf(stderr, "%s: unknown hash engine %s\n", index_path, fx.engine);
+		return 1;
+	}
+	BIG_PRIME = fx.modulus;
+	k = fx.k;
+	t_opened = now_ms();
+
+	num_matched = (int *) calloc(fx.ndocs > 0 ? fx.ndocs : 1, sizeof(int));
+	if (!num_matched) {
+		fprintf(stderr, "failed to allocate the results. No memory\n");
+		exit(1);
+	}
+	/* a winnowed index is probed with the query's fingerprints, 
+		 a full one with its m/k chunks */
+	to_be_matched = m / k;
+	if (fx.winnow > 1)
+		to_be_matched = winnow_fingerprints(qs, m, k, fx.winnow, &fps, &fp_off);
+	for (i = 0; i < to_be_matched; i++) {
+		h = fps ? fps[i] : hash(&qs[i*k], k);
+		r = fp_index_find(&fx, h);
+		probes++;
+		if (r < 0)
+			continue;
+		/* records of one hash are sorted by document: count each document once */
+		for (d = -1; r < fx.nrecs && fx.recs[r].hash == h; r++, records++) {
+			if (fx.recs[r].doc != d) {
+				d = fx.recs[r].doc;
+				num_matched[d]++;
+			}
+		}
+	}
+	if (PRINT_TIMING)
+		fprintf(stderr, "%s: %d documents, %lld records, open %.3f ms, match %.3f ms, "
+				"%d probes, %lld records matched\n",
+				index_path, fx.ndocs, fx.nrecs, t_opened - t_start, now_ms() - t_opened, 
+				probes, records);
+
+	for (d = 0; d < fx.ndocs; d++) {
+		printf("%s: %.2f matched: %d out of %lld\n", fx.names[d],
+				(double)num_matched[d]/to_be_matched, num_matched[d], to_be_matched);
+	}
+	free(num_matched);
+	free(fps);
+	free(fp_off);
+	fp_index_close(&fx);
+	return 0;
+}
+
+/* Match every query qnames[0..nqueries) against the one document 'ref'
+	 with RKBATCH (-r): the chunks of all queries share one bloom filter
+	 and chunk table (rabin_karp_multibuild), so ref is loaded and scanned
+	 once however many queries there are. Print one result line per query,
+	 the same as ./rkmatch -t 2 query ref prints. Return the exit status. */
+int
+multi_query_match(const char *ref, char **qnames, int nqueries, int k, int nthreads,
+                  int bloom_kind, double bloom_fpr)
+{
+	batch_index ix;
+	char *qs = NULL, *doc;
+	long long *qoff, *qlen, *num_matched;
+	long long total = 0, doc_len, hits, to_be_matched;
+	double t_start = now_ms(), t_built, t_loaded;
+	int i;
+
+	qoff = (long long *) malloc(sizeof(long long) * nqueries);
+	qlen = (long long *) malloc(sizeof(long long) * nqueries);
+	num_matched = (long long *) malloc(sizeof(long long) * nqueries);
+	if (!qoff || !qlen || !num_matched) {
+		fprintf(stderr, "failed to allocate %d queries. No memory\n", nqueries);
+		exit(1);
+	}
+	for (i = 0; i < nqueries; i++) {
+		load_file(qnames[i], &doc, &qlen[i]);
+		qoff[i] = total;
+		/* the chunk table indexes the queries with ints */
+		if (total + qlen[i] > INT_MAX) {
+			fprintf(stderr, "%s: the queries must be below 2 GB in all\n", qnames[i]);
+			exit(1);
+		}
+		qs = (char *) realloc(qs, total + qlen[i] + 1);
+		if (!qs) {
+			fprintf(stderr, "failed to allocate the queries. No memory\n");
+			exit(1);
+		}
+		memcpy(&qs[total], doc, qlen[i]);
+		total += qlen[i];
+		qs[total] = 0;
+		free(doc);
+	}
+	ix = rabin_karp_multibuild(k, qs, nqueries, qoff, qlen, bloom_kind, bloom_fpr);
+	t_built = now_ms();
+	if (PRINT_TIMING || bloom_fpr > 0)
+		fprintf(stderr, "bloom filter: %lld bits, %d hashes, %d chunks of %d queries, expected fpr %.3g\n",
+				ix.bf.bsz, ix.bf.nhash, ix.nfp, nqueries, bloom_expected_fpr(ix.bf, ix.nfp));
+
+	load_file(ref, &doc, &doc_len);
+	t_loaded = now_ms();
+	rabin_karp_batchmatch(&ix, k, qs, doc, doc_len, nthreads, &hits, num_matched);
+	if (PRINT_TIMING)
+		fprintf(stderr, "%s: %lld bytes normalized, %d queries (%lld bytes), build %.3f ms, "
+				"load %.3f ms, match %.3f ms, %lld windows, %lld bloom hits\n",
+				ref, doc_len, nqueries, total, t_built - t_start, t_loaded - t_built,
+				now_ms() - t_loaded, doc_len >= k ? doc_len - k + 1 : 0, hits);
+
+	for (i = 0; i < nqueries; i++) {
+		to_be_matched = qlen[i] / k;
+		printf("%s: %.2f matched: %lld out of %lld\n", qnames[i], 
+				(double)num_matched[i]/to_be_matched, num_matched[i], to_be_matched);
+	}
+	rabin_karp_batchfree(&ix);
+	free(doc);
+	free(qs);
+	free(qoff);
+	free(qlen);
+	free(num_matched);
+	return 0;
+}
+
 int 
 main(int argc, char **argv)
 {
 	int k = 100; /* default match size is 100*/
 	int which_algo = SIMPLE; /* default match algorithm is simple */
+	int nthreads = 1; /* documents and RKBATCH scans use a single thread by default */
+	int block_sz = 0; /* documents are loaded whole unless streaming is asked for */
+	int bloom_kind = BLOOM_CLASSIC; /* RKBATCH filter layout */
+	double bloom_fpr = 0; /* RKBATCH filter sized by bits per chunk unless set */
+	char *index_path = NULL; /* match against a k-gram index instead (-i) */
+	char *ref_path = NULL; /* match several queries against this document (-r) */
+	int winnow = 0; /* RKBATCH inserts every chunk unless a window is given (-w) */
 
-	char *qdoc, *doc; 
-	int qdoc_len, doc_len;
-	int i;
-	int num_matched = 0;
-	int to_be_matched;
+	char *qdoc; 
+	long long qdoc_len;
+	int i, nworkers;
+	long long to_be_matched;
 	int c;
+	match_queue q;
+	pthread_t *tids;
 
 	/* Refuse to run on platform with a different size for long long*/
 	assert(sizeof(long long) == 8);
 
 	/*getopt is a C library function to parse command line options */
-	while (( c = getopt(argc, argv, "t:k:q:")) != -1) {
+	while (( c = getopt(argc, argv, "t:k:q:j:l:Tb:H:f:p:i:w:r:")) != -1) {
 		switch (c) 
 		{
 			case 't':
@@ -330,64 +1281,239 @@ main(int argc, char **argv)
 			case 'q':
 				BIG_PRIME = atoi(optarg);
 				break;
+			case 'j':
+				nthreads = atoi(optarg);
+				if (nthreads < 1) {
+					fprintf(stderr, "-j needs a positive number of threads\n");
+					exit(1);
+				}
+				break;
+			case 'l':
+				if (strcmp(optarg, "read") == 0) {
+					LOADER = LOAD_READ;
+				} else if (strcmp(optarg, "mmap") == 0) {
+					LOADER = LOAD_MMAP;
+				} else if (strcmp(optarg, "fused") == 0) {
+					LOADER = LOAD_FUSED;
+				} else {
+					fprintf(stderr, "-l takes read, mmap or fused\n");
+					exit(1);
+				}
+				break;
+			case 'T':
+				PRINT_TIMING = 1;
+				break;
+			case 'H':
+				if (!rk_select_engine(optarg)) {
+					fprintf(stderr, "-H takes one of: %s\n", RK_ENGINE_NAMES);
+					exit(1);
+				}
+				break;
+			case 'f':
+				if (strcmp(optarg, "classic") == 0) {
+					bloom_kind = BLOOM_CLASSIC;
+				} else if (strcmp(optarg, "blocked") == 0) {
+					bloom_kind = BLOOM_BLOCKED;
+				} else if (strcmp(optarg, "pow2") == 0) {
+					bloom_kind = BLOOM_POW2;
+				} else {
+					fprintf(stderr, "-f takes classic, blocked or pow2\n");
+					exit(1);
+				}
+				break;
+			case 'p':
+				bloom_fpr = atof(optarg);
+				if (!(bloom_fpr > 0 && bloom_fpr < 1)) {
+					fprintf(stderr, "-p needs a false positive rate between 0 and 1\n");
+					exit(1);
+				}
+				break;
+			case 'i':
+				index_path = optarg;
+				break;
+			case 'r':
+				ref_path = optarg;
+				break;
+			case 'w':
+				winnow = atoi(optarg);
+				if (winnow < 1) {
+					fprintf(stderr, "-w needs a positive winnowing window\n");
+					exit(1);
+				}
+				break;
+			case 'b':
+				block_sz = atoi(optarg);
+				if (block_sz < 1) {
+					fprintf(stderr, "-b needs a positive block size in bytes\n");
+					exit(1);
+				}
+				break;
 			default:
 				fprintf(stderr,
-						"Valid options are: -t <algo type> -k <match size> -q <prime modulus>\n");
+						"Valid options are: -t <algo type> -k <match size> -q <prime modulus> -j <threads>\n"
+						"                   -l <read|mmap|fused> -T (print timings) -b <stream block bytes>\n"
+						"                   -H <hash engine: %s>\n"
+						"                   -f <bloom layout: classic blocked pow2> -p <bloom false positive rate>\n"
+						"                   -i <k-gram index from rkindex> -w <winnowing window>\n"
+						"                   -r <reference doc matched by every query>\n",
+						RK_ENGINE_NAMES);
 				exit(1);
 			}
 	}
 
+	if (which_algo != SIMPLE && which_algo != RK && which_algo != RKBATCH 
+			&& which_algo != AHOCORASICK && which_algo != SUFFIXARRAY && which_algo != SHIFTOR
+			&& which_algo != HORSPOOL && which_algo != TWOWAY) {
+		fprintf(stderr,"Wrong algorithm type, choose from 0 1 2 3 4 5 6 7\n");
+		exit(1);
+	}
+	if (which_algo == SHIFTOR && (k < 1 || k > SO_MAX_K)) {
+		fprintf(stderr,"Shift-Or (-t 5) needs a snippet size of 1 to %d\n", SO_MAX_K);
+		exit(1);
+	}
+	if (block_sz > 0 && which_algo != RKBATCH) {
+		fprintf(stderr,"Streaming (-b) is only supported by RKBATCH (-t 2)\n");
+		exit(1);
+	}
+	if (LOADER == LOAD_FUSED && (which_algo != RKBATCH || block_sz > 0 || winnow > 0)) {
+		fprintf(stderr,"-l fused is only supported by RKBATCH (-t 2) without -b or -w\n");
+		exit(1);
+	}
+	if (winnow > 0 && index_path) {
+		fprintf(stderr,"-i winnows with the window the index was built with (rkindex -w)\n");
+		exit(1);
+	}
+	if (winnow > 0 && (which_algo != RKBATCH || block_sz > 0)) {
+		fprintf(stderr,"Winnowing (-w) is only supported by RKBATCH (-t 2) without -b\n");
+		exit(1);
+	}
+	if (winnow > 0 && winnow < 2*k - 1) {
+		fprintf(stderr,"warning: -w %d keeps more fingerprints than the m/k chunks, "
+				"use -w %d or more for a smaller filter\n", winnow, 2*k - 1);
+	}
+	if (ref_path && (which_algo != RKBATCH || block_sz > 0 || winnow > 0 || index_path 
+				|| LOADER == LOAD_FUSED)) {
+		fprintf(stderr,"-r is only supported by RKBATCH (-t 2) without -b, -w, -i or -l fused\n");
+		exit(1);
+	}
+
 	/* optind is a global variable set by getopt() 
 		 it now contains the index of the first argv-element 
 		 that is not an option*/
-	if (argc - optind < 1) {
-		printf("Usage: ./rkmatch query_doc doc\n");
+	if (index_path) {
+		if (argc - optind != 1) {
+			printf("Usage: ./rkmatch -i index query_doc\n");
+			exit(1);
+		}
+		load_file(argv[optind], &qdoc, &qdoc_len);
+		c = index_match(index_path, qdoc, qdoc_len);
+		free(qdoc);
+		return c;
+	}
+	if (argc - optind < (ref_path ? 1 : 2)) {
+		printf("Usage: ./rkmatch query_doc doc1 [doc2...]\n"
+				"       ./rkmatch -t 2 -r doc query_doc1 [query_doc2...]\n");
 		exit(1);
 	}
 
+	SIMPLE_FIND = substr_select(k);
+	CHUNK_EQUAL = substr_equal_select(k);
+
+	if (ref_path) {
+		NORMALIZE_THREADS = nthreads;
+		return multi_query_match(ref_path, &argv[optind], argc - optind, k, nthreads,
+				bloom_kind, bloom_fpr);
+	}
+
 	/* argv[optind] contains the query_doc argument */
-	read_file(argv[optind], &qdoc, &qdoc_len); 
-	qdoc_len = normalize(qdoc, qdoc_len);
-	/* argv[optind+1] contains the doc argument */
-	read_file(argv[optind+1], &doc, &doc_len);
-	doc_len = normalize(doc, doc_len);
+	NORMALIZE_THREADS = nthreads;
+	load_file(argv[optind], &qdoc, &qdoc_len); 
+	/* the chunk tables, automata and Shift-Or states index the query with ints */
+	if (qdoc_len > INT_MAX) {
+		fprintf(stderr, "%s: query documents must be below 2 GB\n", argv[optind]);
+		exit(1);
+	}
 
-	switch (which_algo) 
-		{
-			case SIMPLE:
-				/* for each of the qdoc_len/k chunks of qdoc, 
-					 check if it appears in doc as a substring*/
-				for (i = 0; (i+k) <= qdoc_len; i += k) {
-					if (simple_match(qdoc+i, k, doc, doc_len)) {
-						num_matched++;
-					}
-				}
-				break;
-			case RK:
-				/* for each of the qdoc_len/k chunks of qdoc, 
-					 check if it appears in doc as a substring using 
-				   the rabin-karp substring matching algorithm */
-				for (i = 0; (i+k) <= qdoc_len; i += k) {
-					if (rabin_karp_match(qdoc+i, k, doc, doc_len)) {
-						num_matched++;
-					}
-				}
-				break;
-			case RKBATCH:
-				/* match all qdoc_len/k chunks simultaneously (in batch) by using a bloom filter*/
-				num_matched = rabin_karp_batchmatch(((qdoc_len*10/k)>>3)<<3, k, qdoc, qdoc_len, doc, doc_len);
-				break;
-			default :
-				fprintf(stderr,"Wrong algorithm type, choose from 0 1 2\n");
+	/* argv[optind+1...] contain the doc arguments */
+	q.fnames = &argv[optind+1];
+	q.ndocs = argc - optind - 1;
+	q.num_matched = (long long *) calloc(q.ndocs, sizeof(long long));
+	q.next = 0;
+	pthread_mutex_init(&q.lock, NULL);
+	q.which_algo = which_algo;
+	q.k = k;
+	q.qdoc = qdoc;
+	q.qdoc_len = qdoc_len;
+	q.block_sz = block_sz;
+
+	/* one document: all threads work on its scan. 
+		 several documents: each thread takes whole documents off the queue */
+	nworkers = (q.ndocs < nthreads) ? q.ndocs : nthreads;
+	q.scan_threads = (q.ndocs == 1) ? nthreads : 1;
+	/* the threads left over by the workers help normalize their documents */
+	NORMALIZE_THREADS = nthreads / nworkers;
+	if (q.ndocs > 1)
+		PRINT_RK_HASH = 0;
+
+	if (which_algo == RKBATCH) {
+		q.ix = rabin_karp_batchbuild(((qdoc_len*10/k)>>3)<<3, k, qdoc, qdoc_len, 
+				bloom_kind, bloom_fpr, winnow);
+		if (PRINT_TIMING || bloom_fpr > 0)
+			fprintf(stderr, "bloom filter: %lld bits, %d hashes, %d %s, expected fpr %.3g\n",
+					q.ix.bf.bsz, q.ix.bf.nhash, q.ix.nfp, winnow ? "fingerprints" : "chunks",
+					bloom_expected_fpr(q.ix.bf, q.ix.nfp));
+	}
+	if (which_algo == AHOCORASICK)
+		q.ac = ac_build(qdoc, qdoc_len, k);
+	if (which_algo == SHIFTOR)
+		q.so = so_build(qdoc, qdoc_len, k);
+	if (which_algo == HORSPOOL)
+		q.hp = hp_build(qdoc, qdoc_len, k);
+	if (which_algo == TWOWAY)
+		q.tw = tw_build(qdoc, qdoc_len, k);
+
+	tids = (pthread_t *) malloc(sizeof(pthread_t) * nworkers);
+	if (!q.num_matched || !tids) {
+		fprintf(stderr, "failed to allocate the document queue. No memory\n");
+		exit(1);
+	}
+	if (nworkers == 1) {
+		match_worker(&q);
+	} else {
+		for (i = 0; i < nworkers; i++) {
+			if (pthread_create(&tids[i], NULL, match_worker, &q) != 0) {
+				perror("pthread_create ");
 				exit(1);
+			}
+		}
+		for (i = 0; i < nworkers; i++) {
+			pthread_join(tids[i], NULL);
 		}
+	}
 	
-	to_be_matched = qdoc_len / k;
-	printf("%.2f matched: %d out of %d\n", (double)num_matched/to_be_matched, 
-			num_matched, to_be_matched);
+	/* with -w, the fraction of the query's fingerprints found */
+	to_be_matched = (which_algo == RKBATCH) ? q.ix.nfp : qdoc_len / k;
+	for (i = 0; i < q.ndocs; i++) {
+		if (q.ndocs > 1)
+			printf("%s: ", q.fnames[i]);
+		printf("%.2f matched: %lld out of %lld\n", (double)q.num_matched[i]/to_be_matched, 
+				q.num_matched[i], to_be_matched);
+	}
 
+	if (which_algo == RKBATCH)
+		rabin_karp_batchfree(&q.ix);
+	if (which_algo == AHOCORASICK)
+		ac_free(&q.ac);
+	if (which_algo == SHIFTOR)
+		so_free(&q.so);
+	if (which_algo == HORSPOOL)
+		hp_free(&q.hp);
+	if (which_algo == TWOWAY)
+		tw_free(&q.tw);
+	pthread_mutex_destroy(&q.lock);
+	free(q.num_matched);
+	free(tids);
 	free(qdoc);
-	free(doc);
 
 	return 0;
 }
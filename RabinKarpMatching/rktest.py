@@ -1,6 +1,6 @@
 #!/usr/bin/env python
 
-import subprocess, random, sys, time
+import subprocess, random, sys, time, os
 
 THRES=20
 def get_rand_nums(size):
@@ -98,6 +98,17 @@ def test_bloom(bsz,seed):
     print "\tbloom test completed" 
  
 
+def test_kernel_binary(name,iterations,seed,*extra):
+  print "   '%s" % name, iterations, seed, ' '.join(extra),"\'"
+  p = subprocess.Popen(["./" + name, str(iterations), str(seed)] + list(extra),stdout=subprocess.PIPE,stderr=subprocess.PIPE)
+  [s,ss] = p.communicate()
+  r = p.wait()
+  if (r != 0) :
+    print "%s failed (returncode=%d)\n" % (name, r), s, ss
+    sys.exit(1)
+  else:
+    print "\t", s.strip()
+
 def test_near_match(algo,fsize):
         xs = get_rand_string(fsize)
 	write_to_file(xs,'X')
@@ -140,6 +151,91 @@ def test_near_miss(algo,fsize):
 		print "   'rkmatch -t ", algo, " -k ", THRES, " X Y' X_sz=", len(xs), " Y_sz=", len(ys), ", Y has ", THRES, " chars identical to X"
 		test_command(algo,k=THRES)
 
+def test_multi_query(nqueries,fsize):
+	ys = get_rand_string(fsize)
+	write_to_file(get_denormalized(ys),'Y')
+	names = []
+	for i in range(nqueries):
+		# queries copy a random part of Y, and the last one repeats the first
+		xs = get_rand_string(fsize)
+		cut = random.randint(0, fsize-1)
+		xs[cut:] = ys[cut:cut+random.randint(0, fsize)]
+		names.append('X%d' % i)
+		if (i == nqueries-1):
+			names[i] = names[0]
+		else:
+			write_to_file(get_denormalized(xs),names[i])
+	print "   'rkmatch -t 2 -k ", THRES, " -r Y", ' '.join(names), "'"
+	s1 = ''
+	for x in names:
+		s = subprocess.Popen(["./rkmatch", "-t", "2", "-k", str(THRES), x, "Y"],stdout=subprocess.PIPE).communicate()[0]
+		s1 += x + ": " + s.splitlines()[-1] + "\n"
+	p2 = subprocess.Popen(["./rkmatch", "-t", "2", "-k", str(THRES), "-r", "Y"] + names,stdout=subprocess.PIPE,stderr=subprocess.PIPE)
+	[s2,ss2] = p2.communicate()
+	r2 = p2.wait()
+	s2 = '\n'.join(s2.splitlines()[-nqueries:]) + "\n"
+	for x in set(names):
+		os.remove(x)
+	if (r2 != 0 or s1 != s2):
+		print "----One query at a time ----\n" , s1 , "----All queries at once (returncode=%d)----\n" % r2, s2 , ss2
+		sys.exit(1)
+	else:
+		print "\t%d queries matched as one at a time" % nqueries
+
+def write_fixtures(fsize,ysize=0):
+	# writes X and a series of Y's, yielding after each one what Y is;
+	# with ysize, each Y is repeated up to at least ysize bytes
+	def write_y(ys):
+		write_to_file(ys * (ysize // len(ys) + 1),'Y')
+	xs = get_rand_string(fsize)
+	zs = get_rand_string(fsize)
+	half = fsize // 2
+	write_to_file(xs,'X')
+	write_y(get_denormalized(xs))
+	yield "Y is a denormalized version of X"
+	write_y(get_denormalized(xs[half:] + xs[:half]))
+	yield "Y is X rotated by %d chars" % half
+	write_y(get_denormalized(zs[:half] + xs[half:]))
+	yield "Y is identical to X in the last %d chars" % (fsize-half)
+	cut = random.randint(0, fsize-1)
+	write_y(get_denormalized(zs[:cut] + xs[:THRES] + zs[cut:]))
+	yield "Y has %d chars identical to X" % THRES
+	write_y(zs)
+	yield "Y is unrelated to X"
+
+def run_rkmatch(args):
+	p = subprocess.Popen(["./rkmatch"] + args + ["X","Y"],stdout=subprocess.PIPE,stderr=subprocess.PIPE)
+	[s,ss] = p.communicate()
+	r = p.wait()
+	if (r != 0) :
+		print "'rkmatch %s X Y' did not terminate normally (returncode=%d)\n" % (' '.join(args), r), ss
+		sys.exit(1)
+	return s
+
+def test_against(base,args,fsize,tol=-1,ysize=0):
+	# args must print what base prints on every fixture, or with tol >= 0
+	# a matched fraction within tol of base's
+	for desc in write_fixtures(fsize,ysize):
+		print "   'rkmatch", ' '.join(args), "X Y' against 'rkmatch", ' '.join(base), "X Y',", desc
+		s1 = run_rkmatch(base)
+		s2 = run_rkmatch(args)
+		if (tol < 0):
+			same = s1 == s2
+		else:
+			same = abs(float(s1.splitlines()[-1].split()[0]) - float(s2.splitlines()[-1].split()[0])) <= tol
+		if (not same):
+			print "----rkmatch", ' '.join(base), "----\n", s1, "----rkmatch", ' '.join(args), "----\n", s2
+			sys.exit(1)
+
+def test_rejected(args):
+	print "   'rkmatch", ' '.join(args), "X Y' is rejected"
+	p = subprocess.Popen(["./rkmatch"] + args + ["X","Y"],stdout=subprocess.PIPE,stderr=subprocess.PIPE)
+	[s,ss] = p.communicate()
+	r = p.wait()
+	if (r == 0 or s != '' or ss == ''):
+		print "----rkmatch", ' '.join(args), "(returncode=%d)----\n" % r, s, ss
+		sys.exit(1)
+
 if __name__ == '__main__':
 	which_test = -1
 	if (len(sys.argv) > 1) :
@@ -168,6 +264,8 @@ if __name__ == '__main__':
 			test_bloom(1024,i)
 		for i in range(3):
 			test_bloom(65536,i)
+		# past the range of hash_i (more than 2^27 bits)
+		test_kernel_binary('bloom_test',150000000,1,'wide')
 		print "Test bloom filter passed"
 
 	if (which_test == 3 or which_test == -1):
@@ -176,3 +274,73 @@ if __name__ == '__main__':
 		test_near_miss(2,30000)
 		print "Test RKBATCH passed"
 
+	if (which_test == 4 or which_test == -1):
+		print "Test normalize kernels ...."
+		for i in range(3):
+			test_kernel_binary('normalize_test',20000,i)
+		print "Test normalize kernels passed"
+
+	if (which_test == 5 or which_test == -1):
+		print "Test substring kernels ...."
+		for i in range(3):
+			test_kernel_binary('substr_test',20000,i)
+		print "Test substring kernels passed"
+
+	if (which_test == 6 or which_test == -1):
+		print "Test rolling hash lanes ...."
+		for i in range(3):
+			test_kernel_binary('rkhash_test',2000,i)
+		print "Test rolling hash lanes passed"
+
+	if (which_test == 7 or which_test == -1):
+		print "Test RKBATCH with many queries ...."
+		for i in range(3):
+			test_multi_query(8, 30000)
+		print "Test RKBATCH with many queries passed"
+
+	if (which_test == 8 or which_test == -1):
+		print "Test RKBATCH winnowing ...."
+		# from w = 2k-1 on fewer fingerprints than chunks, see rkmatch.c
+		for w in [4, 2*THRES-1, 100]:
+			test_against(["-t", "2", "-k", str(THRES)], ["-t", "2", "-k", str(THRES), "-w", str(w)], 30000, 0.05)
+		print "Test RKBATCH winnowing passed"
+
+	if (which_test == 9 or which_test == -1):
+		print "Test RKBATCH with threads ...."
+		# Y past the size normalize_parallel() starts at (docload.c)
+		for j in [2, 4]:
+			test_against(["-t", "2", "-k", str(THRES), "-j", "1"], ["-t", "2", "-k", str(THRES), "-j", str(j)], 30000, -1, 4<<20)
+		print "Test RKBATCH with threads passed"
+
+	if (which_test == 10 or which_test == -1):
+		print "Test Aho-Corasick ...."
+		for k in [THRES, 100]:
+			test_against(["-t", "0", "-k", str(k)], ["-t", "3", "-k", str(k)], 30000)
+		print "Test Aho-Corasick passed"
+
+	if (which_test == 11 or which_test == -1):
+		print "Test Shift-Or ...."
+		for k in [THRES, 64]:
+			test_against(["-t", "0", "-k", str(k)], ["-t", "5", "-k", str(k)], 30000)
+		# one state word per chunk holds k <= 64 bits
+		test_rejected(["-t", "5", "-k", "65"])
+		print "Test Shift-Or passed"
+
+	if (which_test == 12 or which_test == -1):
+		print "Test Horspool and Two-Way ...."
+		for algo in [6, 7]:
+			for k in [THRES, 100]:
+				test_against(["-t", "0", "-k", str(k)], ["-t", str(algo), "-k", str(k)], 30000)
+		print "Test Horspool and Two-Way passed"
+
+	if (which_test == 13 or which_test == -1):
+		print "Test RKBATCH streaming ...."
+		# blocks shorter than k, and shorter than the documents
+		for b in [THRES // 2, 4096]:
+			test_against(["-t", "2", "-k", str(THRES)], ["-t", "2", "-k", str(THRES), "-b", str(b)], 30000)
+		print "Test RKBATCH streaming passed"
+
+	if (which_test == 14 or which_test == -1):
+		print "Test RKBATCH fused with loading ...."
+		test_against(["-t", "2", "-k", str(THRES)], ["-t", "2", "-k", str(THRES), "-l", "fused"], 30000)
+		print "Test RKBATCH fused with loading passed"
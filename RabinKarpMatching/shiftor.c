@@ -0,0 +1,298 @@
+/***********************************************************
+ Shift-Or (bitap) matching of all m/k query chunks in one pass,
+ for k <= 64. Each distinct chunk t keeps a state word D[t] whose
+ bit i is clear iff the last i+1 bytes read equal its first i+1
+ bytes; reading byte c makes it D[t] = (D[t] << 1) | masks[c][t].
+ The chunk occurs ending at that byte when bit k-1 is clear.
+ All the states step together on the same byte: the mask row of c
+ is contiguous over chunks, so the SSE2 and AVX2 kernels advance 2
+ or 4 states per instruction. Found chunks are swapped out of the
+ active columns (in a private copy of the masks), so the work per
+ byte shrinks as chunks are found, and the scan stops once all of
+ them are.
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rkhash.h"
+#include "chunktab.h"
+#include "shiftor.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SO_SIMD 1
+#endif
+
+static void *
+so_alloc(size_t sz)
+{
+  void *p = malloc(sz);
+  if (!p) {
+    fprintf(stderr, "shiftor: failed to allocate %lu bytes. No memory\n", (unsigned long) sz);
+    exit(1);
+  }
+  return p;
+}
+
+/* Build the mask table of the distinct chunks among the m/k chunks of qs.
+   Repeated chunks share a state, found through the chunks' RK hashes. */
+so_matcher
+so_build(const char *qs, long long m, int k)
+{
+  so_matcher so;
+  chunk_table seen;
+  long long h;
+  int i, j, t, c;
+
+  so.k = k;
+  so.nchunks = (int) (m / k);
+  so.nterms = 0;
+  so.chunk_term = (int *) so_alloc(sizeof(int) * (so.nchunks > 0 ? so.nchunks : 1));
+  seen = chunktab_init(so.nchunks);
+  for (i = 0; i < so.nchunks; i++)
+  {
+    h = hash(&qs[i*k], k);
+    for (j = chunktab_first(&seen, h); j >= 0; j = chunktab_next(&seen, j))
+      if (memcmp(&qs[j*k], &qs[i*k], k) == 0)
+        break;
+    if (j >= 0) {
+      so.chunk_term[i] = so.chunk_term[j];
+    } else {
+      so.chunk_term[i] = so.nterms++;
+      chunktab_add(&seen, h, i);
+    }
+  }
+  chunktab_free(&seen);
+
+  so.stride = (so.nterms + 3) & ~3;
+  if (so.stride == 0) so.stride = 4;
+  so.masks = (unsigned long long *) so_alloc(sizeof(unsigned long long) * 256 * so.stride);
+  memset(so.masks, 0xff, sizeof(unsigned long long) * 256 * so.stride);
+  for (i = 0; i < so.nchunks; i++)
+  {
+    t = so.chunk_term[i];
+    for (j = 0; j < k; j++)
+    {
+      c = (unsigned char) qs[i*k + j];
+      so.masks[c * so.stride + t] &= ~(1ULL << j);
+    }
+  }
+  return so;
+}
+
+void
+so_free(so_matcher *so)
+{
+  free(so->masks);
+  free(so->chunk_term);
+  so->masks = NULL;
+  so->chunk_term = NULL;
+}
+
+/* A kernel steps the first 'active' states (rounded up to its vector
+   width; the columns past active are all ones) over ts[i], ts[i+1], ...
+   and returns just after the first byte at which one of them has bit
+   'hi' clear, or n if none does. */
+typedef long long (*so_kernel)(const unsigned long long *masks, unsigned long long *state,
+                         int stride, int active, unsigned long long hi,
+                         const unsigned char *ts, long long i, long long n);
+
+static long long
+so_step_scalar(const unsigned long long *masks, unsigned long long *state,
+               int stride, int active, unsigned long long hi,
+               const unsigned char *ts, long long i, long long n)
+{
+  const unsigned long long *row;
+  unsigned long long d, acc;
+  int j;
+
+  for (; i < n; i++)
+  {
+    row = masks + (size_t) ts[i] * stride;
+    acc = ~0ULL;
+    for (j = 0; j < active; j++)
+    {
+      d = (state[j] << 1) | row[j];
+      state[j] = d;
+      acc &= d;
+    }
+    if (!(acc & hi))
+      return i + 1;
+  }
+  return n;
+}
+
+#ifdef SO_SIMD
+
+__attribute__((target("sse2")))
+static long long
+so_step_sse2(const unsigned long long *masks, unsigned long long *state,
+             int stride, int active, unsigned long long hi,
+             const unsigned char *ts, long long i, long long n)
+{
+  const unsigned long long *row;
+  __m128i d, acc;
+  int j;
+
+  for (; i < n; i++)
+  {
+    row = masks + (size_t) ts[i] * stride;
+    acc = _mm_set1_epi32(-1);
+    for (j = 0; j < active; j += 2)
+    {
+      d = _mm_loadu_si128((const __m128i *) &state[j]);
+      d = _mm_or_si128(_mm_slli_epi64(d, 1), _mm_loadu_si128((const __m128i *) &row[j]));
+      _mm_storeu_si128((__m128i *) &state[j], d);
+      acc = _mm_and_si128(acc, d);
+    }
+    acc = _mm_and_si128(acc, _mm_unpackhi_epi64(acc, acc));
+    if (!((unsigned long long) _mm_cvtsi128_si64(acc) & hi))
+      return i + 1;
+  }
+  return n;
+}
+
+__attribute__((target("avx2")))
+static long long
+so_step_avx2(const unsigned long long *masks, unsigned long long *state,
+             int stride, int active, unsigned long long hi,
+             const unsigned char *ts, long long i, long long n)
+{
+  const unsigned long long *row;
+  __m256i d, acc;
+  __m128i a;
+  int j;
+
+  for (; i < n; i++)
+  {
+    row = masks + (size_t) ts[i] * stride;
+    acc = _mm256_set1_epi32(-1);
+    for (j = 0; j < active; j += 4)
+    {
+      d = _mm256_loadu_si256((const __m256i *) &state[j]);
+      d = _mm256_or_si256(_mm256_slli_epi64(d, 1), _mm256_loadu_si256((const __m256i *) &row[j]));
+      _mm256_storeu_si256((__m256i *) &state[j], d);
+      acc = _mm256_and_si256(acc, d);
+    }
+    a = _mm_and_si128(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    a = _mm_and_si128(a, _mm_unpackhi_epi64(a, a));
+    if (!((unsigned long long) _mm_cvtsi128_si64(a) & hi))
+      return i + 1;
+  }
+  return n;
+}
+
+#endif
+
+/* Run ts[0..n-1] past every chunk with the given kernel. Return how many
+   of the m/k chunks (counting repeated chunks each time, as SIMPLE and RK
+   do) appear in ts. */
+static int
+so_run(const so_matcher *so, const char *ts, long long n, so_kernel step)
+{
+  unsigned long long *masks, *state, hi;
+  int *term;
+  char *found;
+  long long i = 0;
+  int j, c, last, active = so->nterms, num_matched = 0;
+  size_t row_bytes = sizeof(unsigned long long) * so->stride;
+
+  if (so->nterms == 0 || n < so->k) return 0;
+  /* the columns are reordered as chunks are found */
+  masks = (unsigned long long *) so_alloc(row_bytes * 256);
+  memcpy(masks, so->masks, row_bytes * 256);
+  state = (unsigned long long *) so_alloc(row_bytes);
+  memset(state, 0xff, row_bytes);
+  term = (int *) so_alloc(sizeof(int) * so->stride);
+  for (j = 0; j < so->stride; j++)
+    term[j] = j;
+  found = (char *) calloc(so->nterms, 1);
+  if (!found) {
+    fprintf(stderr, "so_match: failed to allocate %d flags. No memory\n", so->nterms);
+    exit(1);
+  }
+  hi = 1ULL << (so->k - 1);
+
+  while (active > 0 && i < n)
+  {
+    i = step(masks, state, so->stride, active, hi, (const unsigned char *) ts, i, n);
+    for (j = 0; j < active; )
+    {
+      if (state[j] & hi) {
+        j++;
+        continue;
+      }
+      /* chunk term[j] ends at ts[i-1]: move the last active column here
+         and retire its old slot to all ones */
+      found[term[j]] = 1;
+      last = --active;
+      state[j] = state[last];
+      term[j] = term[last];
+      state[last] = ~0ULL;
+      for (c = 0; c < 256; c++)
+      {
+        masks[(size_t) c * so->stride + j] = masks[(size_t) c * so->stride + last];
+        masks[(size_t) c * so->stride + last] = ~0ULL;
+      }
+    }
+  }
+  for (j = 0; j < so->nchunks; j++)
+    num_matched += found[so->chunk_term[j]];
+  free(masks);
+  free(state);
+  free(term);
+  free(found);
+  return num_matched;
+}
+
+int
+so_match_scalar(const so_matcher *so, const char *ts, long long n)
+{
+  return so_run(so, ts, n, so_step_scalar);
+}
+
+#ifdef SO_SIMD
+
+int
+so_match_sse2(const so_matcher *so, const char *ts, long long n)
+{
+  return so_run(so, ts, n, so_step_sse2);
+}
+
+int
+so_match_avx2(const so_matcher *so, const char *ts, long long n)
+{
+  return so_run(so, ts, n, so_step_avx2);
+}
+
+#else
+
+int
+so_match_sse2(const so_matcher *so, const char *ts, long long n)
+{
+  return so_match_scalar(so, ts, n);
+}
+
+int
+so_match_avx2(const so_matcher *so, const char *ts, long long n)
+{
+  return so_match_scalar(so, ts, n);
+}
+
+#endif
+
+/* Match with the widest kernel this CPU supports */
+int
+so_match(const so_matcher *so, const char *ts, long long n)
+{
+#ifdef SO_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+    return so_match_avx2(so, ts, n);
+  if (__builtin_cpu_supports("sse2"))
+    return so_match_sse2(so, ts, n);
+#endif
+  return so_match_scalar(so, ts, n);
+}
@@ -0,0 +1,27 @@
+/***********************************************************
+ File Name: shiftor.h
+ Description: bit-parallel (Shift-Or) matching of the m/k chunks
+              of a query, for chunks of at most 64 bytes
+ **********************************************************/
+
+#define SO_MAX_K 64
+
+/* One 64-bit state word per distinct chunk. masks holds 256 rows of
+   stride words: bit i of masks[c*stride + t] is clear iff byte i of
+   distinct chunk t is c. Columns past nterms are all ones. */
+typedef struct {
+	unsigned long long *masks;
+	int stride;       /* nterms rounded up to a multiple of 4 (one AVX2 vector) */
+	int k;
+	int *chunk_term;  /* distinct chunk of each of the nchunks chunks */
+	int nchunks;
+	int nterms;       /* number of distinct chunks */
+} so_matcher;
+
+so_matcher so_build(const char *qs, long long m, int k);
+void so_free(so_matcher *so);
+
+int so_match(const so_matcher *so, const char *ts, long long n);
+int so_match_scalar(const so_matcher *so, const char *ts, long long n);
+int so_match_sse2(const so_matcher *so, const char *ts, long long n);
+int so_match_avx2(const so_matcher *so, const char *ts, long long n);
@@ -0,0 +1,203 @@
+/***********************************************************
+ Skip-based search for long chunks.
+ Horspool compares a window from its last byte, and on a mismatch
+ moves it so that the byte under the window's end lines up with that
+ byte's last occurrence in the chunk (by up to k bytes). Two-Way
+ (Crochemore and Perrin) splits the chunk at a critical position,
+ matches the right part left to right and then the left part, and
+ moves by the right part's progress or by the chunk's period; it
+ never reads a document byte more than twice, whatever the chunk.
+ Both tables are built once per chunk of the query and shared by
+ every document.
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "skipsearch.h"
+
+static void *
+skip_alloc(size_t sz)
+{
+  void *p = malloc(sz);
+  if (!p) {
+    fprintf(stderr, "skipsearch: failed to allocate %lu bytes. No memory\n", (unsigned long) sz);
+    exit(1);
+  }
+  return p;
+}
+
+hp_index
+hp_build(const char *qs, long long m, int k)
+{
+  hp_index hp;
+  int *shift;
+  int i, j, c;
+
+  hp.k = k;
+  hp.nchunks = (int) (m / k);
+  hp.shift = (int *) skip_alloc(sizeof(int) * 256 * (hp.nchunks > 0 ? hp.nchunks : 1));
+  for (j = 0; j < hp.nchunks; j++)
+  {
+    shift = &hp.shift[256 * j];
+    for (c = 0; c < 256; c++)
+      shift[c] = k;
+    for (i = 0; i < k - 1; i++)
+      shift[(unsigned char) qs[j*k + i]] = k - 1 - i;
+  }
+  return hp;
+}
+
+void
+hp_free(hp_index *hp)
+{
+  free(hp->shift);
+  hp->shift = NULL;
+}
+
+/* The first offset of chunk j (p, k bytes) in ts, or -1 */
+long long
+hp_find(const hp_index *hp, int j, const char *p, const char *ts, long long n)
+{
+  const int *shift = &hp->shift[256 * j];
+  int k = hp->k;
+  long long i = 0;
+  char last = p[k-1];
+  unsigned char c;
+
+  while (i <= n - k)
+  {
+    c = (unsigned char) ts[i + k - 1];
+    if ((char) c == last && memcmp(&ts[i], p, k - 1) == 0)
+      return i;
+    i += shift[c];
+  }
+  return -1;
+}
+
+/* The start of the maximal suffix of p[0..k-1], under the byte order
+   (rev = 0) or its reverse (rev = 1), and that suffix's period in *per */
+static int
+tw_max_suffix(const unsigned char *p, int k, int rev, int *per)
+{
+  int ms = -1, j = 0, q = 1, r = 1;
+  unsigned char a, b;
+
+  while (j + q < k)
+  {
+    a = p[j + q];
+    b = p[ms + q];
+    if (rev ? (a > b) : (a < b)) {
+      j += q;
+      q = 1;
+      r = j - ms;
+    } else if (a == b) {
+      if (q != r) {
+        q++;
+      } else {
+        j += r;
+        q = 1;
+      }
+    } else {
+      ms = j++;
+      q = r = 1;
+    }
+  }
+  *per = r;
+  return ms;
+}
+
+tw_index
+tw_build(const char *qs, long long m, int k)
+{
+  tw_index tw;
+  const unsigned char *p;
+  int j, s1, s2, p1, p2, ell, per;
+
+  tw.k = k;
+  tw.nchunks = (int) (m / k);
+  tw.ell = (int *) skip_alloc(sizeof(int) * (tw.nchunks > 0 ? tw.nchunks : 1));
+  tw.per = (int *) skip_alloc(sizeof(int) * (tw.nchunks > 0 ? tw.nchunks : 1));
+  tw.periodic = (char *) skip_alloc(tw.nchunks > 0 ? tw.nchunks : 1);
+  for (j = 0; j < tw.nchunks; j++)
+  {
+    p = (const unsigned char *) &qs[j*k];
+    /* the later of the two maximal suffixes gives a critical factorization */
+    s1 = tw_max_suffix(p, k, 0, &p1);
+    s2 = tw_max_suffix(p, k, 1, &p2);
+    if (s1 > s2) {
+      ell = s1 + 1;
+      per = p1;
+    } else {
+      ell = s2 + 1;
+      per = p2;
+    }
+    tw.ell[j] = ell;
+    /* the right part's period is the chunk's when the left part repeats it */
+    if (memcmp(p, p + per, ell) == 0) {
+      tw.per[j] = per;
+      tw.periodic[j] = 1;
+    } else {
+      tw.per[j] = ((ell > k - ell) ? ell : k - ell) + 1;
+      tw.periodic[j] = 0;
+    }
+  }
+  return tw;
+}
+
+void
+tw_free(tw_index *tw)
+{
+  free(tw->ell);
+  free(tw->per);
+  free(tw->periodic);
+  tw->ell = NULL;
+  tw->per = NULL;
+  tw->periodic = NULL;
+}
+
+/* The first offset of chunk j (p, k bytes) in ts, or -1 */
+long long
+tw_find(const tw_index *tw, int j, const char *p, const char *ts, long long n)
+{
+  int k = tw->k, ell = tw->ell[j], per = tw->per[j];
+  int i, memory = 0;
+  long long pos = 0;
+
+  if (tw->periodic[j]) {
+    /* after moving by the period, the first k-per bytes are known to match */
+    while (pos <= n - k)
+    {
+      i = (ell > memory) ? ell : memory;
+      while (i < k && p[i] == ts[pos + i]) i++;
+      if (i < k) {
+        pos += i - ell + 1;
+        memory = 0;
+        continue;
+      }
+      i = ell - 1;
+      while (i >= memory && p[i] == ts[pos + i]) i--;
+      if (i < memory)
+        return pos;
+      pos += per;
+      memory = k - per;
+    }
+  } else {
+    while (pos <= n - k)
+    {
+      i = ell;
+      while (i < k && p[i] == ts[pos + i]) i++;
+      if (i < k) {
+        pos += i - ell + 1;
+        continue;
+      }
+      i = ell - 1;
+      while (i >= 0 && p[i] == ts[pos + i]) i--;
+      if (i < 0)
+        return pos;
+      pos += per;
+    }
+  }
+  return -1;
+}
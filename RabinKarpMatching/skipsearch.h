@@ -0,0 +1,30 @@
+/***********************************************************
+ File Name: skipsearch.h
+ Description: Horspool and Two-Way search for the m/k chunks of a
+              query, preprocessed once per chunk
+ **********************************************************/
+
+/* Horspool: row j of shift is how far chunk j may move when the last
+   byte under its window is c */
+typedef struct {
+	int *shift;       /* nchunks rows of 256 */
+	int k;
+	int nchunks;
+} hp_index;
+
+/* Two-Way: the critical factorization of each chunk */
+typedef struct {
+	int *ell;         /* the chunk splits into [0, ell) and [ell, k) */
+	int *per;         /* how far to move after a match of the right part */
+	char *periodic;   /* ell is short of a full period: remember the prefix matched */
+	int k;
+	int nchunks;
+} tw_index;
+
+hp_index hp_build(const char *qs, long long m, int k);
+void hp_free(hp_index *hp);
+long long hp_find(const hp_index *hp, int j, const char *p, const char *ts, long long n);
+
+tw_index tw_build(const char *qs, long long m, int k);
+void tw_free(tw_index *tw);
+long long tw_find(const tw_index *tw, int j, const char *p, const char *ts, long long n);
@@ -0,0 +1,257 @@
+/***********************************************************
+ Substring search for SIMPLE.
+ A window of ts can only equal p if its first and last bytes do.
+ The SSE2 and AVX2 kernels compare both of them at 16 or 32 window
+ positions at once (loading ts at i and at i+k-1), and memcmp()
+ only the middle of the windows that pass. Real text rarely has
+ the same pair of bytes k-1 apart, so almost every position is
+ ruled out without leaving the vector registers. The scalar kernel
+ applies the same test one position at a time.
+ The kernels are also stamped out for the common snippet sizes
+ (SUBSTR_FIXED_K), with k a constant: the offset of the last byte is
+ an immediate and the middle compare is a fixed run of 8-byte word
+ compares instead of a memcmp() call. substr_select() and
+ substr_equal_select() hand out the one for a given k.
+ **********************************************************/
+
+#include <string.h>
+
+#include "substr.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SUBSTR_SIMD 1
+#endif
+
+#define INLINE inline __attribute__((always_inline))
+
+/* a[0..k) == b[0..k)? With k a constant, the word loop is unrolled. */
+static INLINE int
+substr_equal_words(const char *a, const char *b, int k)
+{
+  unsigned long long x, y;
+  int i;
+
+  if (k < 8)
+    return memcmp(a, b, k) == 0;
+  for (i = 0; i + 8 <= k; i += 8)
+  {
+    memcpy(&x, a + i, 8);
+    memcpy(&y, b + i, 8);
+    if (x != y) return 0;
+  }
+  /* the last, partial word overlaps the one before it */
+  if (i < k) {
+    memcpy(&x, a + k - 8, 8);
+    memcpy(&y, b + k - 8, 8);
+    return x == y;
+  }
+  return 1;
+}
+
+/* does the window at ts, whose first and last bytes match, equal p? */
+static INLINE int
+substr_middle(const char *p, int k, const char *ts)
+{
+  return k <= 2 || substr_equal_words(ts + 1, p + 1, k - 2);
+}
+
+/* positions i... one at a time; also the tail of the vector kernels */
+static INLINE long long
+substr_tail(const char *p, int k, const char *ts, long long n, long long i)
+{
+  char first = p[0], last = p[k-1];
+  for (; i <= n - k; i++)
+  {
+    if (ts[i] == first && ts[i+k-1] == last && substr_middle(p, k, &ts[i]))
+      return i;
+  }
+  return -1;
+}
+
+static INLINE long long
+substr_scalar_body(const char *p, int k, const char *ts, long long n)
+{
+  if (k < 1 || n < k) return -1;
+  return substr_tail(p, k, ts, n, 0);
+}
+
+long long
+substr_find_scalar(const char *p, int k, const char *ts, long long n)
+{
+  return substr_scalar_body(p, k, ts, n);
+}
+
+#ifdef SUBSTR_SIMD
+
+int
+substr_has_sse2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("sse2");
+}
+
+int
+substr_has_avx2(void)
+{
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+}
+
+__attribute__((target("sse2")))
+static INLINE long long
+substr_sse2_body(const char *p, int k, const char *ts, long long n)
+{
+  __m128i first, last, a, b;
+  unsigned int mask;
+  long long i;
+
+  if (k < 1 || n < k) return -1;
+  first = _mm_set1_epi8(p[0]);
+  last = _mm_set1_epi8(p[k-1]);
+  for (i = 0; i + k - 1 + 16 <= n; i += 16)
+  {
+    a = _mm_loadu_si128((const __m128i *) &ts[i]);
+    b = _mm_loadu_si128((const __m128i *) &ts[i+k-1]);
+    mask = (unsigned int) _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                                          _mm_cmpeq_epi8(b, last)));
+    while (mask) {
+      if (substr_middle(p, k, &ts[i + __builtin_ctz(mask)]))
+        return i + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
+  }
+  return substr_tail(p, k, ts, n, i);
+}
+
+__attribute__((target("avx2")))
+static INLINE long long
+substr_avx2_body(const char *p, int k, const char *ts, long long n)
+{
+  __m256i first, last, a, b;
+  unsigned int mask;
+  long long i;
+
+  if (k < 1 || n < k) return -1;
+  first = _mm256_set1_epi8(p[0]);
+  last = _mm256_set1_epi8(p[k-1]);
+  for (i = 0; i + k - 1 + 32 <= n; i += 32)
+  {
+    a = _mm256_loadu_si256((const __m256i *) &ts[i]);
+    b = _mm256_loadu_si256((const __m256i *) &ts[i+k-1]);
+    mask = (unsigned int) _mm256_movemask_epi8(_mm256_and_si256(_mm256_cmpeq_epi8(a, first),
+                                                                _mm256_cmpeq_epi8(b, last)));
+    while (mask) {
+      if (substr_middle(p, k, &ts[i + __builtin_ctz(mask)]))
+        return i + __builtin_ctz(mask);
+      mask &= mask - 1;
+    }
+  }
+  return substr_tail(p, k, ts, n, i);
+}
+
+__attribute__((target("sse2")))
+long long
+substr_find_sse2(const char *p, int k, const char *ts, long long n)
+{
+  return substr_sse2_body(p, k, ts, n);
+}
+
+__attribute__((target("avx2")))
+long long
+substr_find_avx2(const char *p, int k, const char *ts, long long n)
+{
+  return substr_avx2_body(p, k, ts, n);
+}
+
+#else
+
+int substr_has_sse2(void) { return 0; }
+int substr_has_avx2(void) { return 0; }
+
+long long
+substr_find_sse2(const char *p, int k, const char *ts, long long n)
+{
+  return substr_find_scalar(p, k, ts, n);
+}
+
+long long
+substr_find_avx2(const char *p, int k, const char *ts, long long n)
+{
+  return substr_find_scalar(p, k, ts, n);
+}
+
+#endif
+
+/* The kernels for one constant k. k is still passed, to keep the
+   substr_finder and substr_comparer signatures, but ignored. */
+#ifdef SUBSTR_SIMD
+#define SUBSTR_FIXED_SIMD(K) \
+  __attribute__((target("sse2"))) static long long \
+  substr_find_sse2_##K(const char *p, int k, const char *ts, long long n) \
+  { (void) k; return substr_sse2_body(p, K, ts, n); } \
+  __attribute__((target("avx2"))) static long long \
+  substr_find_avx2_##K(const char *p, int k, const char *ts, long long n) \
+  { (void) k; return substr_avx2_body(p, K, ts, n); }
+#else
+#define SUBSTR_FIXED_SIMD(K) \
+  static long long \
+  substr_find_sse2_##K(const char *p, int k, const char *ts, long long n) \
+  { (void) k; return substr_scalar_body(p, K, ts, n); } \
+  static long long \
+  substr_find_avx2_##K(const char *p, int k, const char *ts, long long n) \
+  { (void) k; return substr_scalar_body(p, K, ts, n); }
+#endif
+
+#define SUBSTR_FIXED(K) \
+  static long long \
+  substr_find_scalar_##K(const char *p, int k, const char *ts, long long n) \
+  { (void) k; return substr_scalar_body(p, K, ts, n); } \
+  static int \
+  substr_equal_##K(const char *a, const char *b, int k) \
+  { (void) k; return substr_equal_words(a, b, K); } \
+  SUBSTR_FIXED_SIMD(K)
+
+SUBSTR_FIXED_K(SUBSTR_FIXED)
+
+/* Find p in ts with the widest kernel this CPU supports */
+long long
+substr_find(const char *p, int k, const char *ts, long long n)
+{
+  return substr_select(k)(p, k, ts, n);
+}
+
+/* The widest kernel this CPU supports, specialised for k if it can be */
+substr_finder
+substr_select(int k)
+{
+  int avx2 = substr_has_avx2(), sse2 = substr_has_sse2();
+#define SUBSTR_CASE(K) \
+  case K: return avx2 ? substr_find_avx2_##K : sse2 ? substr_find_sse2_##K : substr_find_scalar_##K;
+  switch (k)
+  {
+    SUBSTR_FIXED_K(SUBSTR_CASE)
+  }
+#undef SUBSTR_CASE
+  return avx2 ? substr_find_avx2 : sse2 ? substr_find_sse2 : substr_find_scalar;
+}
+
+/* a[0..k) == b[0..k)? */
+int
+substr_equal(const char *a, const char *b, int k)
+{
+  return memcmp(a, b, k) == 0;
+}
+
+/* substr_equal(), specialised for k if it can be */
+substr_comparer
+substr_equal_select(int k)
+{
+#define SUBSTR_CASE(K) case K: return substr_equal_##K;
+  switch (k)
+  {
+    SUBSTR_FIXED_K(SUBSTR_CASE)
+  }
+#undef SUBSTR_CASE
+  return substr_equal;
+}
@@ -0,0 +1,29 @@
+/***********************************************************
+ File Name: substr.h
+ Description: first occurrence of a k-byte string in a document,
+              the search behind SIMPLE
+ **********************************************************/
+
+/* the snippet sizes with kernels specialised at compile time: 
+   X(K) is expanded once for each */
+#define SUBSTR_FIXED_K(X) X(16) X(32) X(50) X(64) X(100)
+
+typedef long long (*substr_finder)(const char *p, int k, const char *ts, long long n);
+typedef int (*substr_comparer)(const char *a, const char *b, int k);
+
+long long substr_find(const char *p, int k, const char *ts, long long n);
+substr_finder substr_select(int k);
+
+/* whether a[0..k) equals b[0..k), and the comparer specialised for k
+   (or substr_equal itself) */
+int substr_equal(const char *a, const char *b, int k);
+substr_comparer substr_equal_select(int k);
+
+/* The individual kernels behind substr_find(). All of them return the
+   first offset of p in ts, or -1; substr_find() picks the fastest one
+   the CPU supports. */
+long long substr_find_scalar(const char *p, int k, const char *ts, long long n);
+long long substr_find_sse2(const char *p, int k, const char *ts, long long n);
+long long substr_find_avx2(const char *p, int k, const char *ts, long long n);
+int substr_has_sse2(void);
+int substr_has_avx2(void);
@@ -0,0 +1,109 @@
+/***********************************************************
+ File Name: substr_test.c
+ Description: differential test of the substring kernels against
+              a plain strncmp() scan
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "substr.h"
+
+typedef long long (*substr_fn)(const char *p, int k, const char *ts, long long n);
+
+#define FIXED_K_ENTRY(K) K,
+const int FIXED_K[] = { SUBSTR_FIXED_K(FIXED_K_ENTRY) };
+
+/* The first offset of p in ts by comparing at every offset, as SIMPLE
+	 used to */
+int
+find_reference(const char *p, int k, const char *ts, int n)
+{
+	int i;
+	for (i = 0; i <= n - k; i++) {
+		if (strncmp(p, &ts[i], (size_t) k) == 0)
+			return i;
+	}
+	return -1;
+}
+
+/* Fill buf with len bytes out of the first 'alphabet' letters, so that
+	 small alphabets give many windows agreeing in their first and last bytes */
+void
+fill_random(char *buf, int len, int alphabet)
+{
+	int i;
+	for (i = 0; i < len; i++)
+		buf[i] = 'a' + random() % alphabet;
+}
+
+int
+check_kernel(const char *name, substr_fn fn, const char *p, int k, const char *ts, int n,
+		int ref)
+{
+	int got = fn(p, k, ts, n);
+	if (got != ref) {
+		printf("%s differs from the reference (k %d, n %d: got %d, expected %d)\n",
+				name, k, n, got, ref);
+		return 0;
+	}
+	return 1;
+}
+
+int
+main(int argc, char **argv)
+{
+	int iterations = 20000;
+	int i, n, k, ref, ok = 1;
+	char *ts, *p;
+
+	if (argc > 1) {
+		iterations = atoi(argv[1]);
+	}
+	if (argc > 2) {
+		srandom(atoi(argv[2]));
+	}
+
+	ts = (char *) malloc(4096 + 1);
+	p = (char *) malloc(200 + 1);
+	for (i = 0; i < iterations && ok; i++) {
+		/* mostly short documents, so that every head/tail split is hit */
+		n = (i % 10 == 0) ? random() % 4096 : random() % 200;
+		/* a third of the chunks are of the sizes with specialised kernels */
+		k = (random() % 3) ? 1 + random() % 100 : FIXED_K[random() % 5];
+		fill_random(ts, n, 1 + random() % 4);
+		ts[n] = 0;
+		/* half the chunks are taken from the document, perhaps with one
+			 byte changed */
+		if (n >= k && random() % 2) {
+			memcpy(p, &ts[random() % (n - k + 1)], k);
+			if (random() % 2)
+				p[random() % k] = 'a' + random() % 4;
+		} else {
+			fill_random(p, k, 1 + random() % 4);
+		}
+		p[k] = 0;
+		ref = find_reference(p, k, ts, n);
+
+		ok = check_kernel("scalar", substr_find_scalar, p, k, ts, n, ref);
+		if (ok && substr_has_sse2())
+			ok = check_kernel("sse2", substr_find_sse2, p, k, ts, n, ref);
+		if (ok && substr_has_avx2())
+			ok = check_kernel("avx2", substr_find_avx2, p, k, ts, n, ref);
+		if (ok)
+			ok = check_kernel("substr_find", substr_find, p, k, ts, n, ref);
+		if (ok && n >= k && substr_equal_select(k)(p, &ts[n-k], k) != (memcmp(p, &ts[n-k], k) == 0)) {
+			printf("substr_equal_select(%d) differs from memcmp\n", k);
+			ok = 0;
+		}
+	}
+
+	if (!ok) {
+		exit(1);
+	}
+	printf("substr: %d searches identical to the reference (sse2 %s, avx2 %s)\n",
+			iterations, substr_has_sse2() ? "checked" : "unsupported",
+			substr_has_avx2() ? "checked" : "unsupported");
+	return 0;
+}
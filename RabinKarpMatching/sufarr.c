@@ -0,0 +1,381 @@
+/***********************************************************
+ Suffix array index of a normalized document.
+ The suffix array is built by induced sorting (SA-IS, Nong, Zhang
+ and Chan) in linear time. A k-chunk is then looked up by binary search over the
+ suffixes in O(k log n), without touching the rest of the text.
+ The index is saved next to the document as a sidecar file:
+   sa_header | text (padded to 4 bytes) | sa[n]
+ which later runs mmap() instead of rebuilding, as long as the
+ document's size and modification time still match the header.
+ Suffix positions are ints (the header records their size), which
+ keeps the index at 5 bytes per text byte but limits it to
+ documents below 2 GB.
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <assert.h>
+#include <limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sufarr.h"
+
+#define SA_MAGIC "RKSA"
+#define SA_VERSION 2
+
+typedef struct {
+	char magic[4];
+	int version;
+	int int_size;            /* sizeof(int) of the writer */
+	int n;                   /* length of the normalized text */
+	long long doc_size;      /* the document the index was built from */
+	long long doc_mtime_sec;
+	long long doc_mtime_nsec;
+} sa_header;
+
+/* byte offsets of the text and sa[] in a sidecar of an n byte text */
+#define SA_TEXT_OFF ((size_t) sizeof(sa_header))
+#define SA_SA_OFF(n) (SA_TEXT_OFF + (((size_t) (n) + 3) & ~(size_t) 3))
+#define SA_FILE_LEN(n) (SA_SA_OFF(n) + sizeof(int) * (size_t) (n))
+
+static void *
+sa_alloc(size_t sz)
+{
+  void *p = malloc(sz ? sz : 1);
+  if (!p) {
+    fprintf(stderr, "sa_build: failed to allocate %lu bytes. No memory\n", (unsigned long) sz);
+    exit(1);
+  }
+  return p;
+}
+
+/* SA-IS over s[0..n-1] whose characters are 0..K and whose last
+   character s[n-1] is a unique smallest sentinel. Characters are bytes
+   at the top level (cs = 1) and ints in the recursion (cs = sizeof(int)). */
+#define chr(i) (cs == sizeof(int) ? ((const int *) s)[i] : ((const unsigned char *) s)[i])
+#define isLMS(i) ((i) > 0 && t[i] && !t[(i)-1])
+
+/* start (end = 0) or one past the end (end = 1) of every character's bucket */
+static void
+sa_buckets(const void *s, int *bkt, int n, int K, int cs, int end)
+{
+  int i, sum = 0;
+  for (i = 0; i <= K; i++) bkt[i] = 0;
+  for (i = 0; i < n; i++) bkt[chr(i)]++;
+  for (i = 0; i <= K; i++) {
+    sum += bkt[i];
+    bkt[i] = end ? sum : sum - bkt[i];
+  }
+}
+
+/* induce the L-type suffixes from the sorted LMS ones, then the S-type */
+static void
+sa_induce(const unsigned char *t, int *SA, const void *s, int *bkt, int n, int K, int cs)
+{
+  int i, j;
+  sa_buckets(s, bkt, n, K, cs, 0);
+  for (i = 0; i < n; i++) {
+    j = SA[i] - 1;
+    if (j >= 0 && !t[j]) SA[bkt[chr(j)]++] = j;
+  }
+  sa_buckets(s, bkt, n, K, cs, 1);
+  for (i = n - 1; i >= 0; i--) {
+    j = SA[i] - 1;
+    if (j >= 0 && t[j]) SA[--bkt[chr(j)]] = j;
+  }
+}
+
+static void
+sa_is(const void *s, int *SA, int n, int K, int cs)
+{
+  unsigned char *t = (unsigned char *) sa_alloc(n);  /* 1 for S-type, 0 for L-type */
+  int *bkt = (int *) sa_alloc(sizeof(int) * (K + 1));
+  int i, j, d, n1, name, prev, pos, diff;
+  int *SA1, *s1;
+
+  t[n-1] = 1;
+  t[n-2] = 0;
+  for (i = n - 3; i >= 0; i--)
+    t[i] = (chr(i) < chr(i+1) || (chr(i) == chr(i+1) && t[i+1])) ? 1 : 0;
+
+  /* stage 1: sort the LMS substrings */
+  sa_buckets(s, bkt, n, K, cs, 1);
+  for (i = 0; i < n; i++) SA[i] = -1;
+  for (i = 1; i < n; i++)
+    if (isLMS(i)) SA[--bkt[chr(i)]] = i;
+  sa_induce(t, SA, s, bkt, n, K, cs);
+
+  /* name them, equal LMS substrings getting the same name */
+  for (i = 0, n1 = 0; i < n; i++)
+    if (isLMS(SA[i])) SA[n1++] = SA[i];
+  for (i = n1; i < n; i++) SA[i] = -1;
+  for (i = 0, name = 0, prev = -1; i < n1; i++) {
+    pos = SA[i];
+    diff = 0;
+    for (d = 0; d < n; d++) {
+      if (prev == -1 || chr(pos+d) != chr(prev+d) || t[pos+d] != t[prev+d]) {
+        diff = 1;
+        break;
+      } else if (d > 0 && (isLMS(pos+d) || isLMS(prev+d))) {
+        break;
+      }
+    }
+    if (diff) {
+      name++;
+      prev = pos;
+    }
+    SA[n1 + pos / 2] = name - 1;
+  }
+  for (i = n - 1, j = n - 1; i >= n1; i--)
+    if (SA[i] >= 0) SA[j--] = SA[i];
+
+  /* stage 2: sort the reduced string, recursing if names repeat */
+  SA1 = SA;
+  s1 = SA + n - n1;
+  if (name < n1) {
+    sa_is(s1, SA1, n1, name - 1, sizeof(int));
+  } else {
+    for (i = 0; i < n1; i++) SA1[s1[i]] = i;
+  }
+
+  /* stage 3: induce the full suffix array from the sorted LMS suffixes */
+  for (i = 1, j = 0; i < n; i++)
+    if (isLMS(i)) s1[j++] = i;
+  for (i = 0; i < n1; i++) SA1[i] = s1[SA1[i]];
+  for (i = n1; i < n; i++) SA[i] = -1;
+  sa_buckets(s, bkt, n, K, cs, 1);
+  for (i = n1 - 1; i >= 0; i--) {
+    j = SA[i];
+    SA[i] = -1;
+    SA[--bkt[chr(j)]] = j;
+  }
+  sa_induce(t, SA, s, bkt, n, K, cs);
+
+  free(bkt);
+  free(t);
+}
+
+#undef chr
+#undef isLMS
+
+/* Fill sa[0..n-1] with the suffix array of text[0..n-1], suffixes
+   ordered by unsigned bytes, a suffix before any longer one it prefixes.
+   text must not contain a 0 byte (normalized text never does), 0 is
+   used as the sentinel. */
+void
+sa_build(const char *text, int n, int *sa)
+{
+  unsigned char *s;
+  int *SA;
+
+  assert(memchr(text, 0, n) == NULL);
+  if (n <= 1) {
+    if (n == 1) sa[0] = 0;
+    return;
+  }
+  s = (unsigned char *) sa_alloc(n + 1);
+  SA = (int *) sa_alloc(sizeof(int) * (n + 1));
+  memcpy(s, text, n);
+  s[n] = 0;
+  sa_is(s, SA, n + 1, 255, 1);
+  /* SA[0] is the sentinel suffix */
+  memcpy(sa, SA + 1, sizeof(int) * n);
+  free(SA);
+  free(s);
+}
+
+/* Build the index of text[0..n-1] in memory. The index takes over text
+   (which must have been malloc()ed) and frees it in sa_index_free(). */
+void
+sa_index_build(char *text, long long n, sa_index *ix)
+{
+  if (n > INT_MAX) {
+    fprintf(stderr, "sa_index_build: %lld bytes is too long for a suffix array of ints\n", n);
+    exit(1);
+  }
+  ix->sa_buf = (int *) sa_alloc(sizeof(int) * (size_t) n);
+  sa_build(text, n, ix->sa_buf);
+  ix->text_buf = text;
+  ix->text = text;
+  ix->sa = ix->sa_buf;
+  ix->n = n;
+  ix->map = NULL;
+  ix->map_len = 0;
+}
+
+/* Map the sidecar at path if it was built from a document that still
+   has doc_st's size and modification time. Return 0 (and leave ix
+   untouched) if there is no such sidecar. */
+int
+sa_index_load(const char *path, const struct stat *doc_st, sa_index *ix)
+{
+  struct stat st;
+  const sa_header *h;
+  void *map;
+  int fd;
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(sa_header)) {
+    close(fd);
+    return 0;
+  }
+  map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    return 0;
+  h = (const sa_header *) map;
+  if (memcmp(h->magic, SA_MAGIC, 4) != 0 || h->version != SA_VERSION
+      || h->int_size != (int) sizeof(int) || h->n < 0
+      || h->doc_size != (long long) doc_st->st_size
+      || h->doc_mtime_sec != (long long) doc_st->st_mtim.tv_sec
+      || h->doc_mtime_nsec != (long long) doc_st->st_mtim.tv_nsec
+      || (size_t) st.st_size != SA_FILE_LEN(h->n)) {
+    munmap(map, st.st_size);
+    return 0;
+  }
+  /* binary searches jump all over the arrays */
+  madvise(map, st.st_size, MADV_RANDOM);
+  ix->n = h->n;
+  ix->text = (const char *) map + SA_TEXT_OFF;
+  ix->sa = (const int *) ((const char *) map + SA_SA_OFF(h->n));
+  ix->map = map;
+  ix->map_len = st.st_size;
+  ix->text_buf = NULL;
+  ix->sa_buf = NULL;
+  return 1;
+}
+
+/* Write ix to the sidecar at path, tagged with doc_st's size and
+   modification time. The file is written under a temporary name and
+   renamed, so a concurrent run never maps half an index.
+   Return 0 if it could not be written. */
+int
+sa_index_save(const sa_index *ix, const char *path, const struct stat *doc_st)
+{
+  static const char pad[4] = { 0, 0, 0, 0 };
+  sa_header h;
+  char *tmp;
+  FILE *f;
+  int fd, ok;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, SA_MAGIC, 4);
+  h.version = SA_VERSION;
+  h.int_size = sizeof(int);
+  h.n = ix->n;
+  h.doc_size = doc_st->st_size;
+  h.doc_mtime_sec = doc_st->st_mtim.tv_sec;
+  h.doc_mtime_nsec = doc_st->st_mtim.tv_nsec;
+
+  tmp = (char *) sa_alloc(strlen(path) + 8);
+  sprintf(tmp, "%s.XXXXXX", path);
+  fd = mkstemp(tmp);
+  if (fd < 0) {
+    free(tmp);
+    return 0;
+  }
+  /* mkstemp creates the file private to the user, the index is as 
+     readable as any other output file */
+  fchmod(fd, 0644);
+  f = fdopen(fd, "wb");
+  if (!f) {
+    close(fd);
+    unlink(tmp);
+    free(tmp);
+    return 0;
+  }
+  ok = fwrite(&h, sizeof(h), 1, f) == 1
+    && fwrite(ix->text, 1, ix->n, f) == (size_t) ix->n
+    && fwrite(pad, 1, SA_SA_OFF(ix->n) - SA_TEXT_OFF - ix->n, f) == SA_SA_OFF(ix->n) - SA_TEXT_OFF - ix->n
+    && fwrite(ix->sa, sizeof(int), ix->n, f) == (size_t) ix->n;
+  ok = (fclose(f) == 0) && ok;
+  if (ok)
+    ok = rename(tmp, path) == 0;
+  if (!ok)
+    unlink(tmp);
+  free(tmp);
+  return ok;
+}
+
+void
+sa_index_free(sa_index *ix)
+{
+  if (ix->map)
+    munmap(ix->map, ix->map_len);
+  free(ix->text_buf);
+  free(ix->sa_buf);
+  ix->map = NULL;
+  ix->text_buf = NULL;
+  ix->sa_buf = NULL;
+}
+
+/* Compare p[0..k-1] with the suffix at sa[i], given that their first *m
+   bytes are known to be equal; *m is advanced to the common length.
+   Return 0 if p is a prefix of the suffix, else <0 or >0 as the suffix
+   sorts before or after p. */
+static int
+sa_compare(const sa_index *ix, int i, const char *p, int k, int *m)
+{
+  const char *s = ix->text + ix->sa[i];
+  int len = ix->n - ix->sa[i];
+  while (*m < k && *m < len && s[*m] == p[*m]) (*m)++;
+  if (*m == k) return 0;
+  if (*m == len) return -1;
+  return ((unsigned char) s[*m] < (unsigned char) p[*m]) ? -1 : 1;
+}
+
+/* Return the rank (index into sa[]) of the first suffix that starts with
+   p[0..k-1], or -1 if p does not occur in the text. The binary search
+   keeps how much of p the suffixes at both ends of the range already
+   match, and skips that prefix when comparing. */
+int
+sa_index_find(const sa_index *ix, const char *p, int k)
+{
+  int lo = 0, hi = ix->n, mid, m, l = 0, r = 0;
+
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    m = (l < r) ? l : r;
+    if (sa_compare(ix, mid, p, k, &m) < 0) {
+      lo = mid + 1;
+      l = m;
+    } else {
+      hi = mid;
+      r = m;
+    }
+  }
+  if (lo == ix->n || r < k)
+    return -1;
+  return lo;
+}
+
+/* Return the number of times p[0..k-1] occurs in the text, given the rank
+   'first' sa_index_find() returned for it: the occurrences are the suffixes
+   from first on that start with p, and a second binary search finds the 
+   end of that run in O(k log n) whatever the number of occurrences. */
+long long
+sa_index_count(const sa_index *ix, const char *p, int k, int first)
+{
+  int lo = first + 1, hi = ix->n, mid, m, l = k, r = 0;
+
+  while (lo < hi)
+  {
+    mid = lo + (hi - lo) / 2;
+    m = (l < r) ? l : r;
+    if (sa_compare(ix, mid, p, k, &m) == 0) {
+      lo = mid + 1;
+      l = m;
+    } else {
+      hi = mid;
+      r = m;
+    }
+  }
+  return lo - first;
+}
@@ -0,0 +1,29 @@
+/***********************************************************
+ File Name: sufarr.h
+ Description: suffix array index over a normalized
+              document, saved next to it as a sidecar file
+ **********************************************************/
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* sa[i] is the start of the i-th smallest suffix of text[0..n-1] */
+typedef struct {
+	const char *text;
+	const int *sa;
+	int n;
+	void *map;        /* the sidecar mapping the arrays live in, or NULL */
+	size_t map_len;
+	char *text_buf;   /* when built in memory: the text and the array */
+	int *sa_buf;
+} sa_index;
+
+void sa_build(const char *text, int n, int *sa);
+
+void sa_index_build(char *text, long long n, sa_index *ix);
+int sa_index_load(const char *path, const struct stat *doc_st, sa_index *ix);
+int sa_index_save(const sa_index *ix, const char *path, const struct stat *doc_st);
+void sa_index_free(sa_index *ix);
+
+int sa_index_find(const sa_index *ix, const char *p, int k);
+long long sa_index_count(const sa_index *ix, const char *p, int k, int first);
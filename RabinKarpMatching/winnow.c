@@ -0,0 +1,120 @@
+/***********************************************************
+ Winnowing: of every w consecutive k-gram hashes keep the smallest
+ (the rightmost one on ties), and record it once however many windows
+ it stays the minimum of. Two texts sharing a substring of at least
+ w+k-1 bytes then share a fingerprint, while only about 2/(w+1) of
+ the k-grams are kept. Hashes compare as unsigned values. w = 1
+ keeps every k-gram. Against the n/k disjoint chunks, winnowing keeps
+ fewer hashes only for w >= 2k-1.
+ **********************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "rkhash.h"
+#include "winnow.h"
+
+void
+winnow_init(winnow_state *st, int w)
+{
+  st->hashes = (long long *) malloc(sizeof(long long) * w);
+  st->pos = (long long *) malloc(sizeof(long long) * w);
+  if (!st->hashes || !st->pos) {
+    fprintf(stderr, "winnow_init: failed to allocate a window of %d. No memory\n", w);
+    exit(1);
+  }
+  st->w = w;
+  st->head = 0;
+  st->len = 0;
+  st->pushed = 0;
+  st->last = -1;
+}
+
+void
+winnow_free(winnow_state *st)
+{
+  free(st->hashes);
+  free(st->pos);
+  st->hashes = NULL;
+  st->pos = NULL;
+}
+
+/* Push the hash h of the k-gram at pos (positions strictly increasing).
+   Return 1, with the fingerprint in *fp and *fp_pos, when the window
+   ending here selects a k-gram not selected before. O(1) amortized:
+   each position enters and leaves the deque once. */
+int
+winnow_push(winnow_state *st, long long h, long long pos, long long *fp, long long *fp_pos)
+{
+  int back, front;
+
+  /* drop the minimum once it slides out of the window */
+  if (st->len > 0 && st->pos[st->head] <= pos - st->w) {
+    st->head = (st->head + 1) % st->w;
+    st->len--;
+  }
+  /* a newer hash that is no larger makes the older ones useless */
+  while (st->len > 0) {
+    back = (st->head + st->len - 1) % st->w;
+    if ((unsigned long long) st->hashes[back] < (unsigned long long) h)
+      break;
+    st->len--;
+  }
+  back = (st->head + st->len) % st->w;
+  st->hashes[back] = h;
+  st->pos[back] = pos;
+  st->len++;
+
+  if (++st->pushed < st->w)
+    return 0;
+  front = st->head;
+  if (st->pos[front] == st->last)
+    return 0;
+  st->last = st->pos[front];
+  *fp = st->hashes[front];
+  *fp_pos = st->pos[front];
+  return 1;
+}
+
+/* Winnow the k-grams of s[0..n-1]: return the number of fingerprints,
+   and their hashes and offsets in arrays allocated here. A text shorter
+   than w+k-1 still gets the minimum of all its k-grams. */
+long long
+winnow_fingerprints(const char *s, long long n, int k, int w, long long **hashes, long long **offsets)
+{
+  winnow_state st;
+  long long h, hashValue, fp, min = 0;
+  long long i, nfp = 0, fp_pos, ngrams = (n >= k) ? n - k + 1 : 0, min_pos = -1;
+
+  *hashes = (long long *) malloc(sizeof(long long) * (ngrams > 0 ? ngrams : 1));
+  *offsets = (long long *) malloc(sizeof(long long) * (ngrams > 0 ? ngrams : 1));
+  if (!*hashes || !*offsets) {
+    fprintf(stderr, "winnow_fingerprints: failed to allocate %lld fingerprints. No memory\n", ngrams);
+    exit(1);
+  }
+  if (ngrams == 0)
+    return 0;
+  winnow_init(&st, w);
+  hashValue = rehashValue(k);
+  h = hash(s, k);
+  for (i = 0; i < ngrams; i++) {
+    if (min_pos < 0 || (unsigned long long) h <= (unsigned long long) min) {
+      min = h;
+      min_pos = i;
+    }
+    if (winnow_push(&st, h, i, &fp, &fp_pos)) {
+      (*hashes)[nfp] = fp;
+      (*offsets)[nfp] = fp_pos;
+      nfp++;
+    }
+    if (i < ngrams - 1)
+      h = rehash(h, hashValue, &s[i], k);
+  }
+  if (nfp == 0) {
+    (*hashes)[0] = min;
+    (*offsets)[0] = min_pos;
+    nfp = 1;
+  }
+  winnow_free(&st);
+  return nfp;
+}
@@ -0,0 +1,25 @@
+/***********************************************************
+ File Name: winnow.h
+ Description: winnowing (Schleimer, Wilkerson and Aiken) of a
+              stream of k-gram hashes down to fingerprints
+ **********************************************************/
+
+/* Keeps the minimum of the last w hashes pushed. The deque holds the
+   positions whose hash is smaller than every hash pushed after them,
+   in ring order: front is the window minimum. */
+typedef struct {
+	long long *hashes;  /* ring of w entries */
+	long long *pos;
+	int w;
+	int head;           /* ring index of the front */
+	int len;            /* entries in the deque */
+	long long pushed;   /* hashes pushed so far */
+	long long last;     /* position of the last fingerprint, -1 if none */
+} winnow_state;
+
+void winnow_init(winnow_state *st, int w);
+void winnow_free(winnow_state *st);
+int winnow_push(winnow_state *st, long long h, long long pos, long long *fp, long long *fp_pos);
+
+long long winnow_fingerprints(const char *s, long long n, int k, int w,
+                              long long **hashes, long long **offsets);